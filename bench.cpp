@@ -0,0 +1,219 @@
+/* Matching throughput benchmark: scanner vs std::regex
+ *
+ * usage: bench [--max-size BYTES] [--save FILE]
+ *              [--baseline FILE] [--threshold FRACTION]
+ *
+ * For every pattern and corpus, prints compile time, bytes/s and matches/s
+ * of both engines, and peak RSS so far. With --save the scanner throughput
+ * of every row is written to FILE. With --baseline it is compared against
+ * FILE instead, and the exit status is 1 if any row is more than
+ * `threshold` (default 0.25) slower than the stored number.
+ *
+ * Wherever std::regex runs too the match counts have to agree, otherwise
+ * the row is marked and the exit status is 1 as well.
+ */
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include "regex_tree.h"
+#include "scanner.h"
+
+typedef std::chrono::steady_clock bench_clock;
+
+//std::regex recurses per input byte and overflows the stack on big inputs
+const std::size_t std_regex_max_size = 1 << 18;
+//every measurement is repeated until it took at least this long
+const double min_seconds = 0.05;
+
+struct pattern {
+	std::string name;
+	std::string regex;
+	std::string corpus;
+};
+
+const std::vector<pattern> patterns = {
+	{"literal",  "error",                               "log"},
+	{"alt",      "(GET|POST) /(a|b|c|d|i|n|x|e)*",      "log"},
+	{"loop",     "user(0|1|2|3|4|5|6|7|8|9)*",          "log"},
+	{"abb",      "(a|b)*abb",                           "random"},
+	{"sparse",   "qz(a|b)*x",                           "random"},
+	{"worst",    "(a|b)*a(a|b)(a|b)(a|b)(a|b)(a|b)",    "worst"},
+};
+
+/* Deterministic synthetic input of the given size */
+std::string make_corpus(const std::string &kind, std::size_t size) {
+	std::mt19937 rng(42);
+	std::string res;
+	res.reserve(size + 128);
+	if(kind == "random") {
+		const std::string letters = "abcdefghijklmnopqrstuvwxyz ";
+		while(res.size() < size)
+			res += letters[rng() % letters.size()];
+	} else if(kind == "worst") {
+		//every byte is a candidate and nearly every one extends a match,
+		//lines keep std::regex's recursion depth bounded
+		while(res.size() < size)
+			res += (res.size() % 64 == 63) ? '\n' : "ab"[rng() % 2];
+	} else { //log
+		const char *levels[] = {"INFO", "INFO", "INFO", "WARN", "error"};
+		const char *methods[] = {"GET", "POST", "PUT"};
+		const char *paths[] = {"/index", "/api/v1/items", "/static/x.css"};
+		while(res.size() < size) {
+			std::stringstream line;
+			line << "2026-10-18 12:" << rng() % 60 << ":" << rng() % 60 << " "
+			     << levels[rng() % 5] << " user" << rng() % 10000 << " "
+			     << methods[rng() % 3] << " " << paths[rng() % 3] << " "
+			     << 100 + rng() % 900 << "\n";
+			res += line.str();
+		}
+	}
+	res.resize(size);
+	return res;
+}
+
+long peak_rss_kb() {
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+/* Runs f repeatedly until min_seconds have passed,
+   returns seconds per run and the result of the last run */
+template<class F>
+double time_runs(F f, long &result) {
+	long runs = 0;
+	auto start = bench_clock::now();
+	double elapsed;
+	do {
+		result = f();
+		runs++;
+		elapsed = std::chrono::duration<double>(bench_clock::now() - start)
+		          .count();
+	} while(elapsed < min_seconds);
+	return elapsed / runs;
+}
+
+std::map<std::string, double> read_baseline(const std::string &file) {
+	std::map<std::string, double> res;
+	std::ifstream in(file);
+	if(!in)
+		throw std::runtime_error("can't read baseline " + file);
+	std::string key;
+	double value;
+	while(in >> key >> value)
+		res[key] = value;
+	return res;
+}
+
+int main(int argc, char **argv) {
+	std::size_t max_size = 1 << 26;
+	std::string save_file, baseline_file;
+	double threshold = 0.25;
+	for(int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if(i + 1 >= argc) {
+			std::cerr << "missing value for " << arg << "\n";
+			return 2;
+		}
+		if(arg == "--max-size")
+			max_size = std::strtoull(argv[++i], nullptr, 10);
+		else if(arg == "--save")
+			save_file = argv[++i];
+		else if(arg == "--baseline")
+			baseline_file = argv[++i];
+		else if(arg == "--threshold")
+			threshold = std::strtod(argv[++i], nullptr);
+		else {
+			std::cerr << "unknown argument " << arg << "\n";
+			return 2;
+		}
+	}
+	std::map<std::string, double> baseline;
+	if(!baseline_file.empty())
+		baseline = read_baseline(baseline_file);
+
+	std::map<std::string, double> results;
+	bool regressed = false, mismatched = false;
+	std::cout << std::left << std::setw(28) << "pattern/corpus/size"
+	          << std::right
+	          << std::setw(12) << "compile_us"
+	          << std::setw(12) << "dfa_MB/s"
+	          << std::setw(14) << "dfa_match/s"
+	          << std::setw(12) << "std_MB/s"
+	          << std::setw(14) << "std_match/s"
+	          << std::setw(12) << "peak_rss_kb" << "\n";
+	for(const auto &pat : patterns) {
+		auto compile_start = bench_clock::now();
+		regex_tree tree(pat.regex);
+		auto d = tree.construct_dfa().minimize().layout();
+		scanner sc(d, tree.construct_reverse_dfa().minimize());
+		double compile_us = std::chrono::duration<double, std::micro>(
+			bench_clock::now() - compile_start).count();
+		std::regex re(pat.regex, std::regex::extended);
+
+		for(std::size_t size = 1 << 10; size <= max_size; size <<= 4) {
+			std::string text = make_corpus(pat.corpus, size);
+			long dfa_matches, std_matches = 0;
+			double dfa_s = time_runs([&] {
+				long count = 0;
+				for(auto &m : sc.matches(text)) {
+					(void)m;
+					count++;
+				}
+				return count;
+			}, dfa_matches);
+			double std_s = 0;
+			if(size <= std_regex_max_size) {
+				std_s = time_runs([&] {
+					return long(std::distance(
+						std::sregex_iterator(text.begin(), text.end(), re),
+						std::sregex_iterator()));
+				}, std_matches);
+			}
+
+			std::string key = pat.name + "/" + pat.corpus + "/"
+			                  + std::to_string(size);
+			double dfa_mbps = size / dfa_s / 1e6;
+			results[key] = dfa_mbps;
+			std::cout << std::left << std::setw(28) << key << std::right
+			          << std::fixed << std::setprecision(1)
+			          << std::setw(12) << compile_us
+			          << std::setw(12) << dfa_mbps
+			          << std::setw(14) << dfa_matches / dfa_s;
+			if(std_s > 0)
+				std::cout << std::setw(12) << size / std_s / 1e6
+				          << std::setw(14) << std_matches / std_s;
+			else
+				std::cout << std::setw(12) << "-" << std::setw(14) << "-";
+			std::cout << std::setw(12) << peak_rss_kb();
+
+			//std::regex::extended is POSIX leftmost-longest too, so a different
+			//count means one of them is wrong, not that it's faster
+			if(std_s > 0 && dfa_matches != std_matches) {
+				std::cout << "  MISMATCH (std::regex found " << std_matches << ")";
+				mismatched = true;
+			}
+			auto b = baseline.find(key);
+			if(b != std::end(baseline) && dfa_mbps < b->second * (1 - threshold)) {
+				std::cout << "  REGRESSION (baseline " << b->second << ")";
+				regressed = true;
+			}
+			std::cout << "\n";
+		}
+	}
+
+	if(!save_file.empty()) {
+		std::ofstream out(save_file);
+		for(const auto &r : results)
+			out << r.first << " " << r.second << "\n";
+	}
+	return regressed || mismatched ? 1 : 0;
+}
@@ -0,0 +1,216 @@
+/* regex2dfa-compile: compile a list of patterns offline
+ *
+ * usage: regex2dfa-compile [options] [PATTERN_FILE]
+ *   --format dfa|dot    output serialized DFAs (default) or graphviz
+ *   --backend followpos|derivative
+ *                       DFA construction to use (default followpos)
+ *   --out FILE          where to write them (default stdout)
+ *   --summary FILE      per pattern tab separated "index states us status"
+ *   --threads N         worker threads (default: all cores)
+ *   --max-states N      give up on patterns needing more DFA states
+ *   --timeout-ms N      soft time budget per pattern, see below
+ *
+ * Patterns are read one per line from PATTERN_FILE or stdin, blank lines are
+ * skipped. Every pattern is compiled and minimized, with the work spread over
+ * all threads. Each output record starts with "# <index> <pattern>", and
+ * totals (states, time, failures, patterns per second) go to stderr.
+ *
+ * The time budget is soft: it is only checked between the construction steps,
+ * so a pattern can overrun it by a whole step (minimizing is quadratic in the
+ * number of states). The state budget is what bounds the work, as
+ * both construction and minimization grow with the number of states.
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "regex_tree.h"
+#include "derivative.h"
+
+typedef std::chrono::steady_clock compile_clock;
+
+struct result {
+	bool ok = false;
+	std::size_t states = 0;
+	double micros = 0;
+	std::string error;
+	std::string output;
+};
+
+struct options {
+	std::string format = "dfa";
+	std::string backend = "followpos";
+	std::string out_file;
+	std::string summary_file;
+	std::string pattern_file;
+	int threads = std::max(1u, std::thread::hardware_concurrency());
+	std::size_t max_states = 2000;
+	long timeout_ms = 10000;
+};
+
+result compile_one(const std::string &pattern, const options &opt) {
+	result res;
+	auto start = compile_clock::now();
+	auto check_time = [&] {
+		if(compile_clock::now() - start > std::chrono::milliseconds(opt.timeout_ms))
+			throw std::runtime_error("time budget exceeded");
+	};
+	try {
+		dfa d;
+		if(opt.backend == "derivative") {
+			//parses on its own, so it never pays for followpos
+			d = construct_derivative_dfa(pattern, opt.max_states);
+		} else {
+			regex_tree tree(pattern);
+			check_time();
+			d = tree.construct_dfa(opt.max_states);
+		}
+		check_time();
+		d = d.minimize();
+		check_time();
+		res.states = d.size();
+		if(opt.format == "dot") {
+			res.output = d.graph();
+		} else {
+			std::stringstream ss;
+			d.serialize(ss);
+			res.output = ss.str();
+		}
+		res.ok = true;
+	} catch(std::exception &e) {
+		res.error = e.what();
+	}
+	res.micros = std::chrono::duration<double, std::micro>(
+		compile_clock::now() - start).count();
+	return res;
+}
+
+int main(int argc, char **argv) {
+	options opt;
+	for(int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if(arg.size() < 2 || arg.substr(0, 2) != "--") {
+			opt.pattern_file = arg;
+			continue;
+		}
+		if(i + 1 >= argc) {
+			std::cerr << "missing value for " << arg << "\n";
+			return 2;
+		}
+		std::string value = argv[++i];
+		if(arg == "--format")
+			opt.format = value;
+		else if(arg == "--backend")
+			opt.backend = value;
+		else if(arg == "--out")
+			opt.out_file = value;
+		else if(arg == "--summary")
+			opt.summary_file = value;
+		else if(arg == "--threads")
+			opt.threads = std::max(1, std::atoi(value.c_str()));
+		else if(arg == "--max-states")
+			opt.max_states = std::strtoull(value.c_str(), nullptr, 10);
+		else if(arg == "--timeout-ms")
+			opt.timeout_ms = std::atol(value.c_str());
+		else {
+			std::cerr << "unknown option " << arg << "\n";
+			return 2;
+		}
+	}
+	if(opt.format != "dfa" && opt.format != "dot") {
+		std::cerr << "--format must be dfa or dot\n";
+		return 2;
+	}
+	if(opt.backend != "followpos" && opt.backend != "derivative") {
+		std::cerr << "--backend must be followpos or derivative\n";
+		return 2;
+	}
+
+	std::vector<std::string> patterns;
+	{
+		std::ifstream file;
+		if(!opt.pattern_file.empty()) {
+			file.open(opt.pattern_file);
+			if(!file) {
+				std::cerr << "can't read " << opt.pattern_file << "\n";
+				return 2;
+			}
+		}
+		std::istream &in = opt.pattern_file.empty() ? std::cin : file;
+		std::string line;
+		while(std::getline(in, line)) {
+			if(!line.empty() && line.back() == '\r')
+				line.pop_back();
+			if(!line.empty())
+				patterns.push_back(line);
+		}
+	}
+
+	//opened before compiling, so a bad path doesn't throw all the work away
+	std::ofstream out_file, summary;
+	auto open = [](std::ofstream &file, const std::string &name) {
+		if(!name.empty())
+			file.open(name);
+		if(!file)
+			std::cerr << "can't write " << name << "\n";
+		return bool(file);
+	};
+	if(!open(out_file, opt.out_file) || !open(summary, opt.summary_file))
+		return 2;
+	std::ostream &out = opt.out_file.empty() ? std::cout : out_file;
+
+	auto start = compile_clock::now();
+	std::vector<result> results(patterns.size());
+	std::atomic<std::size_t> next(0);
+	std::vector<std::thread> workers;
+	for(int t = 0; t < opt.threads; t++) {
+		workers.emplace_back([&] {
+			std::size_t i;
+			while((i = next++) < patterns.size())
+				results[i] = compile_one(patterns[i], opt);
+		});
+	}
+	for(auto &w : workers)
+		w.join();
+	double seconds = std::chrono::duration<double>(
+		compile_clock::now() - start).count();
+
+	std::size_t failures = 0, total_states = 0;
+	for(std::size_t i = 0; i < patterns.size(); i++) {
+		const result &r = results[i];
+		if(summary.is_open()) {
+			summary << i << "\t" << r.states << "\t" << long(r.micros) << "\t"
+			        << (r.ok ? "ok" : r.error) << "\n";
+		}
+		if(!r.ok) {
+			failures++;
+			std::cerr << "pattern " << i << " (" << patterns[i] << "): "
+			          << r.error << "\n";
+			continue;
+		}
+		total_states += r.states;
+		out << "# " << i << " " << patterns[i] << "\n" << r.output;
+	}
+
+	out.flush();
+	summary.flush();
+	if(!out || !summary) {
+		std::cerr << "writing the output failed\n";
+		return 2;
+	}
+
+	std::cerr << patterns.size() << " patterns, "
+	          << patterns.size() - failures << " compiled, "
+	          << failures << " failed, "
+	          << total_states << " states total\n"
+	          << seconds << "s on " << opt.threads << " threads, "
+	          << (seconds > 0 ? patterns.size() / seconds : 0)
+	          << " patterns/s\n";
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,284 @@
+#ifndef MBLIT_DERIVATIVE_H
+#define MBLIT_DERIVATIVE_H
+
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include "regex_tree.h"
+
+/* Second DFA construction backend, using Brzozowski derivatives
+ *
+ * The derivative of a regex r by a letter c matches whatever r matches after
+ * a leading c. Starting from the regex and taking derivatives by every letter
+ * gives a DFA whose states are the derivative terms themselves.
+ *
+ * That only terminates if equal terms are recognized, so terms are hash-consed:
+ * every term is built through a smart constructor that normalizes it and
+ * returns the one shared instance, so two terms are equal iff their pointers
+ * are. The normalizations are
+ *   r|s      flattened, sorted, duplicates and the empty language dropped
+ *   r.s      nothing.r = r.nothing = nothing, eps.r = r.eps = r,
+ *            and always associated to the right
+ *   r*       (r*)* = r*, nothing* = eps* = eps
+ * Shared subexpressions are only stored once and the resulting DFA is usually
+ * close to minimal already.
+ */
+struct term {
+	enum class kind {nothing, epsilon, letter, cat, alt, star};
+	kind k;
+	char letter;
+	std::vector<const term*> sub;
+	bool nullable;
+	//creation order, used for sorting alternatives
+	std::size_t id;
+};
+
+class term_pool {
+	typedef std::tuple<term::kind, char, std::vector<std::size_t>> term_key;
+
+	std::deque<term> terms;
+	std::map<term_key, const term*> unique;
+	std::map<std::pair<const term*, char>, const term*> derivatives;
+	std::set<char> letters;
+	const term *nothing_;
+	const term *epsilon_;
+
+	const term *make(term::kind k, char c, std::vector<const term*> sub,
+	                 bool nullable)
+	{
+		std::vector<std::size_t> ids;
+		for(const term *t : sub)
+			ids.push_back(t->id);
+		term_key key(k, c, ids);
+		auto u = unique.find(key);
+		if(u != std::end(unique))
+			return u->second;
+		terms.push_back({k, c, std::move(sub), nullable, terms.size()});
+		unique[key] = &terms.back();
+		return &terms.back();
+	}
+
+public:
+	term_pool()
+	: nothing_(make(term::kind::nothing, 0, {}, false)),
+	  epsilon_(make(term::kind::epsilon, 0, {}, true))
+	{}
+	term_pool(const term_pool &) = delete;
+	term_pool &operator=(const term_pool &) = delete;
+
+	const term *nothing() const { return nothing_; }
+	const term *epsilon() const { return epsilon_; }
+
+	const term *letter(char c) {
+		letters.insert(c);
+		return make(term::kind::letter, c, {}, false);
+	}
+
+	const term *cat(const term *a, const term *b) {
+		if(a == nothing_ || b == nothing_)
+			return nothing_;
+		if(a == epsilon_)
+			return b;
+		if(b == epsilon_)
+			return a;
+		//(x.y).b -> x.(y.b)
+		if(a->k == term::kind::cat)
+			return cat(a->sub[0], cat(a->sub[1], b));
+		return make(term::kind::cat, 0, {a, b}, a->nullable && b->nullable);
+	}
+
+	const term *alt(const term *a, const term *b) {
+		return alt(std::vector<const term*>{a, b});
+	}
+	const term *alt(const std::vector<const term*> &alternatives) {
+		std::vector<const term*> flat;
+		for(const term *t : alternatives) {
+			if(t->k == term::kind::alt)
+				flat.insert(std::end(flat), std::begin(t->sub), std::end(t->sub));
+			else if(t != nothing_)
+				flat.push_back(t);
+		}
+		std::sort(std::begin(flat), std::end(flat),
+			[](const term *x, const term *y) { return x->id < y->id; });
+		flat.erase(std::unique(std::begin(flat), std::end(flat)),
+		           std::end(flat));
+		if(flat.empty())
+			return nothing_;
+		if(flat.size() == 1)
+			return flat[0];
+		bool nullable = false;
+		for(const term *t : flat)
+			nullable |= t->nullable;
+		return make(term::kind::alt, 0, std::move(flat), nullable);
+	}
+
+	const term *star(const term *a) {
+		if(a == nothing_ || a == epsilon_)
+			return epsilon_;
+		if(a->k == term::kind::star)
+			return a;
+		return make(term::kind::star, 0, {a}, true);
+	}
+
+	/* The derivative of t by c, memoized */
+	const term *derive(const term *t, char c) {
+		auto d = derivatives.find({t, c});
+		if(d != std::end(derivatives))
+			return d->second;
+		const term *res = nothing_;
+		switch(t->k) {
+			case term::kind::nothing:
+			case term::kind::epsilon:
+				break;
+			case term::kind::letter:
+				res = (t->letter == c) ? epsilon_ : nothing_;
+				break;
+			case term::kind::cat:
+				res = cat(derive(t->sub[0], c), t->sub[1]);
+				if(t->sub[0]->nullable)
+					res = alt(res, derive(t->sub[1], c));
+				break;
+			case term::kind::alt: {
+				std::vector<const term*> parts;
+				for(const term *s : t->sub)
+					parts.push_back(derive(s, c));
+				res = alt(parts);
+				break;
+			}
+			case term::kind::star:
+				res = cat(derive(t->sub[0], c), t);
+				break;
+		}
+		derivatives[{t, c}] = res;
+		return res;
+	}
+
+	/* Every letter used by the terms built so far */
+	const std::set<char> &alphabet() const {
+		return letters;
+	}
+
+	/* Number of distinct terms built so far */
+	std::size_t size() const {
+		return terms.size();
+	}
+};
+
+/* Parses a regex straight into terms of a pool
+ * Same grammar and errors as regex_tree, but no tree: none of the position
+ * sets regex_tree keeps in every node are ever built. Sequences and
+ * alternatives are collected first and combined once, so long ones don't
+ * get renormalized for every part.
+ */
+class term_parser {
+	term_pool &pool;
+	const std::string &str;
+	std::size_t pos;
+
+	bool at(char c) const {
+		return pos < str.size() && str[pos] == c;
+	}
+	bool at_letter() const {
+		return pos < str.size()
+		    && std::string("()*+|").find(str[pos]) == std::string::npos;
+	}
+
+	const term *regex() {
+		if(pos == str.size())
+			return pool.epsilon();
+		std::vector<const term*> alternatives = {expr()};
+		while(at('|')) {
+			pos++;
+			alternatives.push_back(expr());
+		}
+		return pool.alt(alternatives);
+	}
+
+	const term *expr() {
+		std::vector<const term*> sequence;
+		while(const term *t = factor())
+			sequence.push_back(t);
+		const term *res = pool.epsilon();
+		for(auto t = sequence.rbegin(); t != sequence.rend(); t++)
+			res = pool.cat(*t, res);
+		return res;
+	}
+
+	//nullptr if there is no term here
+	const term *factor() {
+		const term *res;
+		if(at('(')) {
+			pos++;
+			res = regex();
+			if(!at(')'))
+				throw std::runtime_error("Invalid Regex");
+			pos++;
+		} else if(at_letter()) {
+			res = pool.letter(str[pos++]);
+		} else {
+			return nullptr;
+		}
+		while(at('*')) {
+			pos++;
+			res = pool.star(res);
+		}
+		return res;
+	}
+
+public:
+	term_parser(term_pool &pool_, const std::string &str_)
+	: pool(pool_), str(str_), pos(0)
+	{}
+
+	/* The whole string as one term, throws if it isn't a valid regex */
+	const term *parse() {
+		const term *res = regex();
+		if(pos != str.size())
+			throw std::runtime_error("Invalid Regex");
+		return res;
+	}
+};
+
+/* Builds the DFA for `regex` from derivatives instead of followpos
+   The result accepts the same language as regex_tree(regex).construct_dfa()
+   throws if more than max_states states would be needed */
+inline dfa construct_derivative_dfa(const std::string &regex,
+                                    std::size_t max_states = regex_tree::no_limit)
+{
+	term_pool pool;
+	const term *initial = term_parser(pool, regex).parse();
+
+	dfa res;
+	std::map<const term*, int> state_id = {{initial, 0}};
+	std::deque<const term*> unmarked = {initial};
+	while(!unmarked.empty()) {
+		const term *t = unmarked.front();
+		unmarked.pop_front();
+		std::map<char, int> S;
+		for(char c : pool.alphabet()) {
+			const term *d = pool.derive(t, c);
+			//the empty language is the dead state
+			if(d == pool.nothing())
+				continue;
+			if(!state_id.count(d)) {
+				if(state_id.size() >= max_states)
+					throw std::runtime_error("DFA too big");
+				int id = state_id.size();
+				state_id[d] = id;
+				unmarked.push_back(d);
+			}
+			S[c] = state_id[d];
+		}
+		res.transitions.emplace_back(std::move(S));
+		res.accepting_.push_back(t->nullable);
+	}
+	return res;
+}
+
+#endif //MBLIT_DERIVATIVE_H
@@ -0,0 +1,366 @@
+#include <iostream>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <streambuf>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <boost/coroutine/asymmetric_coroutine.hpp>
+#include "event_loop.h"
+#include "process.h"
+
+typedef boost::coroutines::asymmetric_coroutine<void> coroutine;
+
+/* Stack size for each task, handlers don't recurse so this is plenty */
+static const std::size_t task_stack_size = 256 * 1024;
+
+thread_pool::thread_pool(int count) : stopping(false) {
+	for(int i = 0; i < count; i++) {
+		threads.emplace_back([this] {
+			while(true) {
+				std::function<void()> job;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					ready.wait(lock, [this] { return stopping || !jobs.empty(); });
+					if(jobs.empty())
+						return;
+					job = std::move(jobs.front());
+					jobs.pop_front();
+				}
+				job();
+			}
+		});
+	}
+}
+
+thread_pool::~thread_pool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	ready.notify_all();
+	for(auto &t : threads)
+		t.join();
+}
+
+void thread_pool::submit(std::function<void()> job) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		jobs.push_back(std::move(job));
+	}
+	ready.notify_one();
+}
+
+
+struct event_loop::task {
+	std::unique_ptr<coroutine::push_type> co;
+	//jumps back to the loop from inside the task
+	coroutine::pull_type *yield;
+	//exception thrown by a job the task waited for on the pool
+	std::exception_ptr error;
+};
+
+event_loop::event_loop(thread_pool &pool_)
+: pool(pool_), current(nullptr)
+{
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if(epoll_fd == -1)
+		throw std::runtime_error("epoll_create1 returned -1");
+	wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(wake_fd == -1)
+		throw std::runtime_error("eventfd returned -1");
+	//the wake up fd is the only one registered without a task
+	epoll_event ev = {};
+	ev.events = EPOLLIN;
+	ev.data.ptr = nullptr;
+	if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev) == -1)
+		throw std::runtime_error("epoll_ctl returned -1");
+}
+
+event_loop::~event_loop() {
+	::close(wake_fd);
+	::close(epoll_fd);
+}
+
+void event_loop::spawn(std::function<void()> fn) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		spawned.push_back(std::move(fn));
+	}
+	std::uint64_t one = 1;
+	if(::write(wake_fd, &one, sizeof one) == -1)
+		throw std::runtime_error("eventfd write returned -1");
+}
+
+void event_loop::post(task *t) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		posted.push_back(t);
+	}
+	std::uint64_t one = 1;
+	if(::write(wake_fd, &one, sizeof one) == -1)
+		throw std::runtime_error("eventfd write returned -1");
+}
+
+void event_loop::resume(task *t) {
+	current = t;
+	(*t->co)();
+	current = nullptr;
+	//the task returned instead of suspending
+	if(!*t->co)
+		delete t;
+}
+
+void event_loop::run() {
+	const int max_events = 64;
+	epoll_event events[max_events];
+	while(true) {
+		int n = epoll_wait(epoll_fd, events, max_events, -1);
+		if(n == -1) {
+			if(errno == EINTR)
+				continue;
+			throw std::runtime_error(std::string("epoll_wait returned -1: ")
+			                         + strerror(errno));
+		}
+		for(int i = 0; i < n; i++) {
+			if(events[i].data.ptr) {
+				resume(static_cast<task*>(events[i].data.ptr));
+				continue;
+			}
+			std::uint64_t count;
+			if(::read(wake_fd, &count, sizeof count) == -1 && errno != EAGAIN)
+				throw std::runtime_error("eventfd read returned -1");
+			std::vector<std::function<void()>> new_tasks;
+			std::vector<task*> ready;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				new_tasks.swap(spawned);
+				ready.swap(posted);
+			}
+			for(auto &fn : new_tasks) {
+				task *t = new task();
+				t->co = std::make_unique<coroutine::push_type>(
+					[t, fn](coroutine::pull_type &yield) {
+						t->yield = &yield;
+						try {
+							fn();
+						} catch(std::exception &e) {
+							std::cerr << "task failed: " << e.what() << "\n";
+						}
+					},
+					boost::coroutines::attributes(task_stack_size));
+				resume(t);
+			}
+			for(task *t : ready)
+				resume(t);
+		}
+	}
+}
+
+void event_loop::wait(int fd, unsigned events) {
+	task *self = current;
+	if(!self)
+		throw std::logic_error("event_loop: waiting outside of a task");
+	epoll_event ev = {};
+	ev.events = events | EPOLLONESHOT;
+	ev.data.ptr = self;
+	if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1)
+		throw std::runtime_error("epoll_ctl returned -1");
+	(*self->yield)();
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+void event_loop::wait_readable(int fd) {
+	wait(fd, EPOLLIN);
+}
+
+void event_loop::wait_writable(int fd) {
+	wait(fd, EPOLLOUT);
+}
+
+void event_loop::run_on_pool(std::function<void()> job) {
+	task *self = current;
+	if(!self)
+		throw std::logic_error("event_loop: run_on_pool outside of a task");
+	pool.submit([this, self, &job] {
+		try {
+			job();
+		} catch(...) {
+			self->error = std::current_exception();
+		}
+		post(self);
+	});
+	//the loop only picks up posted tasks after this one suspends, so
+	//there's no race with the job finishing first
+	(*self->yield)();
+	if(self->error) {
+		auto e = self->error;
+		self->error = nullptr;
+		std::rethrow_exception(e);
+	}
+}
+
+//big enough that a large graph only takes a few trips through the loop
+static const std::size_t pipe_chunk = 64 * 1024;
+
+void event_loop::write_all(Process &p, const std::string &input) {
+	write_all(p, input.data(), input.size());
+}
+
+void event_loop::write_all(Process &p, const char *data, std::size_t size) {
+	std::size_t done = 0;
+	while(done < size) {
+		auto count = p.write_some(data + done, size - done);
+		if(!count)
+			wait_writable(p.input_fd());
+		done += count;
+	}
+}
+
+/* Stream buffer handing what is written to it to sink in pipe_chunk sized
+   pieces. If sink returns false the stream goes bad and ignores the rest */
+class sink_streambuf : public std::streambuf {
+public:
+	explicit sink_streambuf(std::function<bool(const char*, std::size_t)> sink_)
+	: sink(std::move(sink_)), buffer(pipe_chunk)
+	{
+		setp(buffer.data(), buffer.data() + buffer.size());
+	}
+protected:
+	int_type overflow(int_type c) override {
+		if(sync() == -1)
+			return traits_type::eof();
+		if(!traits_type::eq_int_type(c, traits_type::eof())) {
+			*pptr() = traits_type::to_char_type(c);
+			pbump(1);
+		}
+		return traits_type::not_eof(c);
+	}
+	int sync() override {
+		bool ok = pptr() == pbase() || sink(pbase(), pptr() - pbase());
+		setp(buffer.data(), buffer.data() + buffer.size());
+		return ok ? 0 : -1;
+	}
+private:
+	std::function<bool(const char*, std::size_t)> sink;
+	std::vector<char> buffer;
+};
+
+//how far a generator on the pool can get ahead of the pipe
+static const std::size_t max_queued_chunks = 4;
+
+/* Chunks on their way from a generator on the pool to the task writing them
+   Shared, so the job can still let go of the lock after the task is done */
+struct event_loop::chunk_queue {
+	std::mutex mutex;
+	std::condition_variable not_full;
+	std::deque<std::string> chunks;
+	bool done = false;       //the generator has returned
+	bool abandoned = false;  //the task stopped taking chunks
+	std::exception_ptr error;
+	task *waiting = nullptr; //suspended until there's a chunk or it's done
+};
+
+void event_loop::write_from_pool(Process &p,
+	std::function<void(std::ostream&)> generator)
+{
+	task *self = current;
+	if(!self)
+		throw std::logic_error("event_loop: write_from_pool outside of a task");
+	auto q = std::make_shared<chunk_queue>();
+	//must be called with q->mutex held
+	auto wake = [this, q] {
+		if(q->waiting) {
+			post(q->waiting);
+			q->waiting = nullptr;
+		}
+	};
+	pool.submit([q, wake, &generator] {
+		std::exception_ptr error;
+		try {
+			sink_streambuf buf([&](const char *data, std::size_t size) {
+				std::unique_lock<std::mutex> lock(q->mutex);
+				q->not_full.wait(lock, [&] {
+					return q->abandoned || q->chunks.size() < max_queued_chunks;
+				});
+				if(q->abandoned)
+					return false;
+				q->chunks.emplace_back(data, size);
+				wake();
+				return true;
+			});
+			std::ostream out(&buf);
+			generator(out);
+			out.flush();
+		} catch(...) {
+			error = std::current_exception();
+		}
+		std::lock_guard<std::mutex> lock(q->mutex);
+		q->done = true;
+		q->error = error;
+		wake();
+	});
+
+	//keep taking chunks until the generator is done even if writing fails,
+	//it may still be using things on this task's stack
+	std::exception_ptr write_error;
+	while(true) {
+		std::string chunk;
+		{
+			std::unique_lock<std::mutex> lock(q->mutex);
+			if(q->chunks.empty()) {
+				if(q->done)
+					break;
+				//as in run_on_pool, the loop can't resume this task before
+				//it suspends
+				q->waiting = self;
+				lock.unlock();
+				(*self->yield)();
+				continue;
+			}
+			chunk = std::move(q->chunks.front());
+			q->chunks.pop_front();
+			if(write_error)
+				continue;
+		}
+		q->not_full.notify_one();
+		try {
+			write_all(p, chunk);
+		} catch(...) {
+			write_error = std::current_exception();
+			std::lock_guard<std::mutex> lock(q->mutex);
+			q->abandoned = true;
+			q->not_full.notify_one();
+		}
+	}
+	if(write_error)
+		std::rethrow_exception(write_error);
+	if(q->error)
+		std::rethrow_exception(q->error);
+}
+
+std::string event_loop::read_all(Process &p) {
+	std::string res;
+	forward_output(p, [&](const char *data, std::size_t size) {
+		res.append(data, size);
+	});
+	return res;
+}
+
+void event_loop::forward_output(Process &p,
+	std::function<void(const char*, std::size_t)> sink)
+{
+	p.set_nonblocking();
+	std::vector<char> buffer(pipe_chunk);
+	while(true) {
+		auto count = p.read_into(buffer.data(), buffer.size());
+		if(count)
+			sink(buffer.data(), count);
+		else if(p.output_done())
+			return;
+		else
+			wait_readable(p.output_fd());
+	}
+}
@@ -0,0 +1,98 @@
+#ifndef MISSBLIT_EVENT_LOOP_H
+#define MISSBLIT_EVENT_LOOP_H
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class Process;
+
+/* Fixed size pool of threads for CPU heavy jobs */
+class thread_pool {
+public:
+	explicit thread_pool(int threads);
+	/* Finishes queued jobs, then joins the threads */
+	~thread_pool();
+
+	/* Queue a job, it runs on one of the pool threads */
+	void submit(std::function<void()> job);
+private:
+	std::mutex mutex;
+	std::condition_variable ready;
+	std::deque<std::function<void()>> jobs;
+	bool stopping;
+	std::vector<std::thread> threads;
+};
+
+/* Single threaded epoll loop running tasks as stackful coroutines
+ *
+ * A task that has to wait (on a pipe, or for a job on the CPU pool)
+ * suspends itself and the loop goes on with other tasks, so thousands of
+ * requests waiting on slow children only cost a coroutine stack each.
+ *
+ * spawn() may be called from any thread, everything else marked
+ * "task only" must be called from inside a task running on this loop.
+ */
+class event_loop {
+public:
+	explicit event_loop(thread_pool &pool);
+	~event_loop();
+
+	/* Start a new task on this loop, thread safe */
+	void spawn(std::function<void()> task);
+
+	/* Run tasks forever on the calling thread */
+	void run();
+
+	/* Suspend the current task until fd is readable / writable (task only) */
+	void wait_readable(int fd);
+	void wait_writable(int fd);
+
+	/* Run job on the CPU pool, suspending the current task until it is done.
+	   Exceptions thrown by job are rethrown here (task only) */
+	void run_on_pool(std::function<void()> job);
+
+	/* Write all of input to the process' stdin (task only) */
+	void write_all(Process &p, const std::string &input);
+	void write_all(Process &p, const char *data, std::size_t size);
+	/* Run generator on the CPU pool, writing what it outputs to the
+	   process' stdin as it goes and suspending until it is done. Only a
+	   few chunks are buffered in between, when they're full generator
+	   waits for the pipe (holding on to its pool thread).
+	   Exceptions thrown by generator are rethrown here (task only) */
+	void write_from_pool(Process &p,
+	                     std::function<void(std::ostream&)> generator);
+	/* Read the process' stdout until it is closed (task only) */
+	std::string read_all(Process &p);
+	/* Hand the process' stdout to sink chunk by chunk as it arrives,
+	   until it is closed (task only) */
+	void forward_output(Process &p,
+	                    std::function<void(const char*, std::size_t)> sink);
+
+private:
+	struct task;
+	struct chunk_queue;
+
+	void wait(int fd, unsigned events);
+	void resume(task *t);
+	//hand t back to the loop from another thread
+	void post(task *t);
+
+	thread_pool &pool;
+	int epoll_fd;
+	int wake_fd; //eventfd, makes epoll_wait return when something is posted
+	task *current;
+
+	std::mutex mutex;
+	std::vector<std::function<void()>> spawned;
+	std::vector<task*> posted;
+};
+
+#endif //MISSBLIT_EVENT_LOOP_H
@@ -3,54 +3,189 @@
 #include <string>
 #include <regex>
 #include <fstream>
+#include <iostream>
+#include <ostream>
 #include <string>
 #include <thread>
 #include <chrono>
+#include <csignal>
 #include <stdlib.h>
 #include <unistd.h>
 #include "rapunzel/fcgi_connection_manager.h"
 #include "regex_tree.h"
 #include "process.h"
+#include "event_loop.h"
+#include "render_cache.h"
 
-void handle_request(fcgi::request r) {
+//threads multiplexing requests, the real work happens on the CPU pool
+const int loop_threads = 2;
+//where rendered output is kept between requests (and restarts)
+const char *cache_dir = "render_cache";
+const std::size_t cache_max_bytes = 256 << 20;
+
+/* Runs as a task on `loop`, suspending while it waits on the CPU pool or dot */
+void handle_request(fcgi::request r, event_loop &loop, render_cache &cache) {
 	auto query = decode_querystring(r.parameter("QUERY_STRING"));
 	std::string regex = query["regex"];
 	std::string mode  = query["mode"];
 	std::string format = query["format"];
-	regex_tree tree(regex);
-	auto d = tree.construct_dfa().minimize();
-    
-	//draw either a tree or a DFA as text or png 
-	//depending on the query string        
-	std::string input;
-	if(mode == "dfa") {        
-		input = d.graph();
-	}
-	else { //default
-		input = tree.graph();
+
+	//output only depends on the query, so the cache key is a fine ETag
+	std::string key = render_cache::key(regex, mode, format);
+	std::string cache_headers = "ETag: \"" + key + "\"\r\n"
+	                            "Cache-Control: public, max-age=86400\r\n";
+	std::string if_none_match = r.parameter("HTTP_IF_NONE_MATCH");
+	if(if_none_match == "*" || if_none_match.find(key) != std::string::npos) {
+		r << "Status: 304 Not Modified\r\n" << cache_headers << "\r\n";
+		return;
+	}
+	if(auto hit = cache.find(key)) {
+		r << "Content-type: " << hit->content_type() << "\r\n"
+		  << cache_headers << "\r\n";
+		//rapunzel only takes strings, so this is the one copy out of the map
+		r << std::string(hit->data(), hit->size());
+		return;
 	}
+
+	//compiling can be slow for big regexes
+	std::unique_ptr<regex_tree> tree;
+	dfa d;
+	bool text = false;
 	std::string output;
-	if(format == "text" || mode == "dfa" && d.size() > 32) {
-		output = input;
-		r << "Content-type: text/html\r\n\r\n<!DOCTYPE html>";
-		if(mode == "dfa" && d.size() > 32)
-			r << "That graph is way too big D: draw it yourself!<br>";
-		r << "<pre>" << output << "</pre>";
-	} else {
-		Process p("dot", {"-Tpng"});
-		p.write(input);
-		p.close_input();
-		output = p.read_all();
-		r << "Content-type: image/png\r\n\r\n";
+	try {
+		loop.run_on_pool([&] {
+			tree = std::make_unique<regex_tree>(regex);
+			d = tree->construct_dfa().minimize();
+			text = format == "text" || mode == "dfa" && d.size() > 32;
+			if(!text)
+				return;
+
+			//draw either a tree or a DFA as text or png
+			//depending on the query string
+			output = "<!DOCTYPE html>";
+			if(mode == "dfa" && d.size() > 32)
+				output += "That graph is way too big D: draw it yourself!<br>";
+			output += "<pre>" + html_escape(mode == "dfa" ? d.graph() : tree->graph())
+			        + "</pre>";
+		});
+	} catch(std::runtime_error &e) {
+		//the parser throws on anything it can't read
+		r << "Status: 400 Bad Request\r\n"
+		     "Content-type: text/plain\r\n\r\n"
+		  << std::string(e.what()) + "\n";
+		return;
+	}
+	if(text) {
+		r << "Content-type: text/html\r\n" << cache_headers << "\r\n";
 		r << output;
+		try {
+			cache.store(key, "text/html", output);
+		} catch(std::runtime_error &e) {
+			//the client has its answer, it just isn't kept
+			std::cerr << "caching " << key << " failed: " << e.what() << "\n";
+		}
+		return;
 	}
+
+	//stream the graph into dot, drawing it on the CPU pool, so it is never
+	//held in memory as a whole
+	Process p("dot", {"-Tpng"});
+	try {
+		loop.write_from_pool(p, [&](std::ostream &dot_in) {
+			if(mode == "dfa")
+				d.graph(dot_in);
+			else //default
+				tree->graph(dot_in);
+		});
+	} catch(std::runtime_error &) {
+		//dot stopped reading early, its output and exit status say why
+	}
+	p.close_input();
+	//dot's png goes out to the client as it arrives and into the cache on
+	//the side. Its stderr comes through the same pipe, so whether this is
+	//a png or an error message is decided from the first bytes
+	static const std::string png_signature = "\x89PNG\r\n\x1a\n";
+	//a broken cache only costs the copy on disk, never the response
+	std::unique_ptr<render_cache::writer> cached;
+	try {
+		cached = std::make_unique<render_cache::writer>(cache, key, "image/png");
+	} catch(std::runtime_error &e) {
+		std::cerr << "caching " << key << " failed: " << e.what() << "\n";
+	}
+	std::string head, error;
+	const std::size_t max_error = 4096;
+	bool decided = false, png = false;
+	loop.forward_output(p, [&](const char *data, std::size_t size) {
+		if(!decided) {
+			head.append(data, size);
+			if(head.size() < png_signature.size()
+			   && png_signature.compare(0, head.size(), head) == 0)
+				return;
+			decided = true;
+			png = head.compare(0, png_signature.size(), png_signature) == 0;
+			if(!png) {
+				error = head.substr(0, max_error);
+				return;
+			}
+			r << "Content-type: image/png\r\n" << cache_headers << "\r\n";
+			//rapunzel only takes strings, one copy per chunk
+			r << head;
+			if(cached)
+				cached->write(head.data(), head.size());
+			return;
+		}
+		if(png) {
+			r << std::string(data, size);
+			if(cached)
+				cached->write(data, size);
+		} else {
+			error.append(data, std::min(size, max_error - error.size()));
+		}
+	});
+	//dot has closed its output by now, so this doesn't block for long
+	int status = p.wait();
+	if(png) {
+		//too late to tell the client if it failed halfway, but the cache
+		//never gets a broken png
+		if(status != 0 || !cached)
+			return;
+		try {
+			cached->commit();
+		} catch(std::runtime_error &e) {
+			std::cerr << "caching " << key << " failed: " << e.what() << "\n";
+		}
+		return;
+	}
+	if(!decided)
+		error = head;
+	//nothing here may be cached, by us or by the browser
+	r << "Status: 500 Internal Server Error\r\n"
+	     "Content-type: text/plain\r\n"
+	     "Cache-Control: no-store\r\n\r\n"
+	  << "dot exited with status " + std::to_string(status) + "\n" << error;
 }
 
 int main() {
+	//a child that exits before reading all its input must not take the
+	//server down with it, writing to it fails with EPIPE instead
+	signal(SIGPIPE, SIG_IGN);
+	thread_pool cpu(std::max(1u, std::thread::hardware_concurrency()));
+	std::vector<std::unique_ptr<event_loop>> loops;
+	std::vector<std::thread> threads;
+	for(int i = 0; i < loop_threads; i++) {
+		loops.push_back(std::make_unique<event_loop>(cpu));
+		event_loop *loop = loops.back().get();
+		threads.emplace_back([loop] { loop->run(); });
+	}
+
+	render_cache cache(cache_dir, cache_max_bytes);
 	fcgi::connection_manager fcgi;
-	while(true) {
-		fcgi::request r = fcgi.get_request();
-		std::thread t(handle_request, std::move(r));
-		t.detach();
+	for(std::size_t i = 0; true; i = (i + 1) % loops.size()) {
+		//std::function needs something copyable
+		auto r = std::make_shared<fcgi::request>(fcgi.get_request());
+		event_loop &loop = *loops[i];
+		loop.spawn([r, &loop, &cache] {
+			handle_request(std::move(*r), loop, cache);
+		});
 	}
 }
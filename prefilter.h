@@ -0,0 +1,444 @@
+#ifndef MBLIT_PREFILTER_H
+#define MBLIT_PREFILTER_H
+
+#include <bitset>
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <set>
+#include <string>
+#include <vector>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include "regex_tree.h"
+
+/* Vectorized byte searches used to skip input that can't start a match.
+ * Each one returns `end` when nothing is found. The SIMD paths are picked at
+ * compile time (-msse2 is the x86-64 default, build with -mavx2 for the wide
+ * path) and everything falls back to a plain loop elsewhere.
+ */
+
+//find the first byte equal to any of the n (1 to 3) bytes in `set`
+inline const char *find_any_of(const char *begin, const char *end,
+                               const char *set, int n)
+{
+	if(n == 1) {
+		//glibc's memchr is already vectorized
+		auto p = std::memchr(begin, set[0], end - begin);
+		return p ? static_cast<const char*>(p) : end;
+	}
+	const char c0 = set[0], c1 = set[1], c2 = set[n > 2 ? 2 : 1];
+	const char *p = begin;
+#if defined(__AVX2__)
+	const __m256i w0 = _mm256_set1_epi8(c0);
+	const __m256i w1 = _mm256_set1_epi8(c1);
+	const __m256i w2 = _mm256_set1_epi8(c2);
+	for(; end - p >= 32; p += 32) {
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+		__m256i eq = _mm256_or_si256(_mm256_cmpeq_epi8(v, w0),
+		             _mm256_or_si256(_mm256_cmpeq_epi8(v, w1),
+		                             _mm256_cmpeq_epi8(v, w2)));
+		unsigned mask = _mm256_movemask_epi8(eq);
+		if(mask)
+			return p + __builtin_ctz(mask);
+	}
+#endif
+#if defined(__SSE2__)
+	const __m128i v0 = _mm_set1_epi8(c0);
+	const __m128i v1 = _mm_set1_epi8(c1);
+	const __m128i v2 = _mm_set1_epi8(c2);
+	for(; end - p >= 16; p += 16) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+		__m128i eq = _mm_or_si128(_mm_cmpeq_epi8(v, v0),
+		             _mm_or_si128(_mm_cmpeq_epi8(v, v1),
+		                          _mm_cmpeq_epi8(v, v2)));
+		unsigned mask = _mm_movemask_epi8(eq);
+		if(mask)
+			return p + __builtin_ctz(mask);
+	}
+#endif
+	for(; p != end; p++) {
+		if(*p == c0 || *p == c1 || *p == c2)
+			return p;
+	}
+	return end;
+}
+
+//find the first byte that is none of the n (1 to 3) bytes in `set`
+//(strspn style, for skipping a run of bytes)
+inline const char *find_none_of(const char *begin, const char *end,
+                                const char *set, int n)
+{
+	const char c0 = set[0], c1 = set[n > 1 ? 1 : 0], c2 = set[n > 2 ? 2 : 0];
+	const char *p = begin;
+#if defined(__AVX2__)
+	const __m256i w0 = _mm256_set1_epi8(c0);
+	const __m256i w1 = _mm256_set1_epi8(c1);
+	const __m256i w2 = _mm256_set1_epi8(c2);
+	for(; end - p >= 32; p += 32) {
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+		__m256i eq = _mm256_or_si256(_mm256_cmpeq_epi8(v, w0),
+		             _mm256_or_si256(_mm256_cmpeq_epi8(v, w1),
+		                             _mm256_cmpeq_epi8(v, w2)));
+		unsigned mask = ~unsigned(_mm256_movemask_epi8(eq));
+		if(mask)
+			return p + __builtin_ctz(mask);
+	}
+#endif
+#if defined(__SSE2__)
+	const __m128i v0 = _mm_set1_epi8(c0);
+	const __m128i v1 = _mm_set1_epi8(c1);
+	const __m128i v2 = _mm_set1_epi8(c2);
+	for(; end - p >= 16; p += 16) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+		__m128i eq = _mm_or_si128(_mm_cmpeq_epi8(v, v0),
+		             _mm_or_si128(_mm_cmpeq_epi8(v, v1),
+		                          _mm_cmpeq_epi8(v, v2)));
+		unsigned mask = ~unsigned(_mm_movemask_epi8(eq)) & 0xffff;
+		if(mask)
+			return p + __builtin_ctz(mask);
+	}
+#endif
+	for(; p != end; p++) {
+		if(*p != c0 && *p != c1 && *p != c2)
+			return p;
+	}
+	return end;
+}
+
+//find the first occurrence of `lit` (memmem style)
+//compares the first and last byte of the literal at once across a block,
+//and only runs memcmp on positions where both line up
+inline const char *find_literal(const char *begin, const char *end,
+                                const std::string &lit)
+{
+	const std::size_t n = lit.size();
+	if(n == 0)
+		return begin;
+	if(std::size_t(end - begin) < n)
+		return end;
+	if(n == 1)
+		return find_any_of(begin, end, lit.data(), 1);
+	//last position a match could start at
+	const char *last = end - n;
+	const char *p = begin;
+#if defined(__AVX2__)
+	const __m256i wf = _mm256_set1_epi8(lit.front());
+	const __m256i wl = _mm256_set1_epi8(lit.back());
+	for(; last - p >= 32; p += 32) {
+		__m256i f = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+		__m256i l = _mm256_loadu_si256(
+			reinterpret_cast<const __m256i*>(p + n - 1));
+		unsigned mask = _mm256_movemask_epi8(
+			_mm256_and_si256(_mm256_cmpeq_epi8(f, wf),
+			                 _mm256_cmpeq_epi8(l, wl)));
+		while(mask) {
+			int i = __builtin_ctz(mask);
+			if(!std::memcmp(p + i + 1, lit.data() + 1, n - 2))
+				return p + i;
+			mask &= mask - 1;
+		}
+	}
+#endif
+#if defined(__SSE2__)
+	const __m128i vf = _mm_set1_epi8(lit.front());
+	const __m128i vl = _mm_set1_epi8(lit.back());
+	for(; last - p >= 16; p += 16) {
+		__m128i f = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+		__m128i l = _mm_loadu_si128(
+			reinterpret_cast<const __m128i*>(p + n - 1));
+		unsigned mask = _mm_movemask_epi8(
+			_mm_and_si128(_mm_cmpeq_epi8(f, vf), _mm_cmpeq_epi8(l, vl)));
+		while(mask) {
+			int i = __builtin_ctz(mask);
+			if(!std::memcmp(p + i + 1, lit.data() + 1, n - 2))
+				return p + i;
+			mask &= mask - 1;
+		}
+	}
+#endif
+	for(; p <= last; p++) {
+		if(*p == lit.front() && !std::memcmp(p + 1, lit.data() + 1, n - 1))
+			return p;
+	}
+	return end;
+}
+
+/* Facts about a DFA that hold for every string it accepts, used to find
+ * candidate match positions without stepping the DFA over every byte.
+ *
+ * Analysis is done on the DFA rather than the tree: by the time it's built the
+ * alternatives have been merged, so e.g. "abc|abd" still gives the prefix "ab".
+ */
+struct prefilter {
+	//true if the start state accepts, every position is then a candidate
+	bool always;
+	//literal that every match starts with (may be empty)
+	std::string prefix;
+	//the bytes leaving the start state towards an accepting state
+	std::bitset<256> first_bytes;
+	//same thing as a list, only filled in when there are 1-3 of them
+	std::string first_list;
+	//bytes that every match contains somewhere
+	std::string required;
+	//literal of 2+ bytes that every match contains, other than the prefix
+	//(may be empty)
+	std::string inner;
+	//longest match, if the DFA only accepts finitely many strings
+	std::size_t max_length;
+
+	static const std::size_t unbounded = std::numeric_limits<std::size_t>::max();
+	//inner literals are only looked for in DFAs up to this size
+	static const int inner_max_states = 4096;
+
+	prefilter() : always(true), max_length(unbounded) {}
+
+	explicit prefilter(const dfa &d)
+	: always(d.accepting(0)), max_length(unbounded)
+	{
+		const int n = d.size();
+		auto live = d.live_states();
+		if(always || !live[0])
+			return;
+
+		//first byte set
+		for(const auto &p : d.transitions[0]) {
+			if(live[p.second])
+				first_bytes.set(static_cast<unsigned char>(p.first));
+		}
+		if(first_bytes.count() <= 3) {
+			for(int c = 0; c < 256; c++) {
+				if(first_bytes.test(c))
+					first_list += static_cast<char>(c);
+			}
+		}
+
+		//prefix: follow the start state while there is only one way to go
+		std::vector<bool> seen(n);
+		int s = 0;
+		while(!d.accepting(s) && !seen[s]) {
+			seen[s] = true;
+			int count = 0, to = n;
+			char c = 0;
+			for(const auto &p : d.transitions[s]) {
+				if(live[p.second]) {
+					count++;
+					c = p.first;
+					to = p.second;
+				}
+			}
+			if(count != 1)
+				break;
+			prefix += c;
+			s = to;
+		}
+
+		//required bytes: c is required if no accepting state is reachable
+		//once every c edge is removed
+		std::set<char> alphabet;
+		for(const auto &m : d.transitions)
+		for(const auto &p : m)
+			alphabet.insert(p.first);
+		for(char c : alphabet) {
+			if(prefix.find(c) != std::string::npos)
+				continue; //prefix check already covers it
+			std::vector<bool> visited(n);
+			std::deque<int> q = {0};
+			visited[0] = true;
+			bool reached = false;
+			while(!q.empty() && !reached) {
+				int a = q.front(); q.pop_front();
+				reached = d.accepting(a);
+				for(const auto &p : d.transitions[a]) {
+					if(p.first != c && !visited[p.second]) {
+						visited[p.second] = true;
+						q.push_back(p.second);
+					}
+				}
+			}
+			if(!reached)
+				required += c;
+		}
+
+		max_length = longest_match(d, live);
+		if(n <= inner_max_states)
+			inner = inner_literal(d, live);
+	}
+
+	/* Length of the longest accepted string, or unbounded if a cycle
+	   can be part of a match */
+	static std::size_t longest_match(const dfa &d, const std::vector<bool> &live)
+	{
+		const int n = d.size();
+		//depth first, 0 = unvisited, 1 = on the stack, 2 = done
+		std::vector<int> mark(n);
+		std::vector<std::size_t> longest(n);
+		std::vector<std::pair<int, bool>> stack = {{0, false}};
+		while(!stack.empty()) {
+			int a = stack.back().first;
+			bool children_done = stack.back().second;
+			stack.pop_back();
+			if(children_done) {
+				longest[a] = 0;
+				for(const auto &p : d.transitions[a]) {
+					if(live[p.second])
+						longest[a] = std::max(longest[a], longest[p.second] + 1);
+				}
+				mark[a] = 2;
+				continue;
+			}
+			if(mark[a] == 2)
+				continue;
+			mark[a] = 1;
+			stack.push_back({a, true});
+			for(const auto &p : d.transitions[a]) {
+				if(!live[p.second])
+					continue;
+				if(mark[p.second] == 1)
+					return unbounded;
+				if(mark[p.second] == 0)
+					stack.push_back({p.second, false});
+			}
+		}
+		return longest[0];
+	}
+
+	/* True if every accepted string contains lit, i.e. no accepting state
+	   can be reached while running a KMP matcher for lit alongside that
+	   never completes */
+	static bool contains_always(const dfa &d, const std::string &lit) {
+		const int m = lit.size();
+		std::vector<int> fail(m + 1);
+		fail[0] = -1;
+		for(int i = 1, k = -1; i <= m; i++) {
+			while(k >= 0 && lit[k] != lit[i-1])
+				k = fail[k];
+			fail[i] = ++k;
+		}
+		auto kmp_next = [&](int k, char c) {
+			while(k >= 0 && (k == m || lit[k] != c))
+				k = fail[k];
+			return k + 1;
+		};
+		std::set<std::pair<int, int>> visited = {{0, 0}};
+		std::vector<std::pair<int, int>> q = {{0, 0}};
+		while(!q.empty()) {
+			auto a = q.back(); q.pop_back();
+			if(d.accepting(a.first))
+				return false;
+			for(const auto &p : d.transitions[a.first]) {
+				std::pair<int, int> b(p.second, kmp_next(a.second, p.first));
+				if(b.second < m && visited.insert(b).second)
+					q.push_back(b);
+			}
+		}
+		return true;
+	}
+
+	/* Candidates are the bytes read along chains of states with a single
+	   way out, extended backwards while every way in reads the same byte.
+	   The longest one every match contains wins */
+	std::string inner_literal(const dfa &d, const std::vector<bool> &live) const
+	{
+		const int n = d.size();
+		const std::size_t max_literal = 64;
+		std::vector<std::vector<std::pair<int, char>>> rev(n);
+		for(int s = 0; s < n; s++) {
+			for(const auto &p : d.transitions[s]) {
+				if(live[s] && live[p.second])
+					rev[p.second].push_back({s, p.first});
+			}
+		}
+		std::set<std::string> candidates;
+		for(int s = 0; s < n; s++) {
+			if(!live[s])
+				continue;
+			std::string lit;
+			std::vector<bool> seen(n);
+			for(int a = s; !d.accepting(a) && !seen[a]
+			               && lit.size() < max_literal; ) {
+				seen[a] = true;
+				int count = 0, to = a;
+				char c = 0;
+				for(const auto &p : d.transitions[a]) {
+					if(live[p.second]) {
+						count++;
+						c = p.first;
+						to = p.second;
+					}
+				}
+				if(count != 1)
+					break;
+				lit += c;
+				a = to;
+			}
+			std::set<int> from = {s};
+			while(lit.size() < max_literal && !from.count(0)) {
+				std::set<int> prev;
+				std::set<char> bytes;
+				for(int a : from) {
+					for(const auto &e : rev[a]) {
+						prev.insert(e.first);
+						bytes.insert(e.second);
+					}
+				}
+				if(bytes.size() != 1)
+					break;
+				lit.insert(lit.begin(), *bytes.begin());
+				from.swap(prev);
+			}
+			if(lit.size() >= 2 && prefix.find(lit) == std::string::npos)
+				candidates.insert(lit);
+		}
+		std::string best;
+		for(const auto &lit : candidates) {
+			if(lit.size() > best.size() && contains_always(d, lit))
+				best = lit;
+		}
+		return best;
+	}
+
+	/* Cheap whole-buffer rejection: false if no match can exist in the range
+	 * because one of the required bytes never occurs
+	 */
+	bool possible(const char *begin, const char *end) const {
+		if(always)
+			return true;
+		for(char c : required) {
+			if(find_any_of(begin, end, &c, 1) == end)
+				return false;
+		}
+		return true;
+	}
+
+	/* Earliest place a match containing the inner literal at `lit` can
+	   start, given that none starts before `from` */
+	const char *start_bound(const char *from, const char *lit) const {
+		if(max_length == unbounded)
+			return from;
+		std::size_t reach = max_length - inner.size();
+		return std::size_t(lit - from) > reach ? lit - reach : from;
+	}
+
+	/* Returns the first position in [begin, end) where a match could start,
+	 * or end if there is none
+	 */
+	const char *next_candidate(const char *begin, const char *end) const {
+		if(always)
+			return begin;
+		if(prefix.size() > 1)
+			return find_literal(begin, end, prefix);
+		if(!first_list.empty())
+			return find_any_of(begin, end, first_list.data(),
+			                   first_list.size());
+		const char *p = begin;
+		for(; p != end; p++) {
+			if(first_bytes.test(static_cast<unsigned char>(*p)))
+				return p;
+		}
+		return end;
+	}
+};
+
+#endif //MBLIT_PREFILTER_H
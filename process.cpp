@@ -8,15 +8,18 @@
 #include <fcntl.h>
 #include <sys/wait.h>
 #include <sys/types.h>
+#include <cerrno>
 #include <cstring>
 #include "process.h"
 
 using namespace std;
 	
 Pipe::Pipe() : open{1,1} {
-	int res = pipe(fd);
+	//other children must not inherit it, or they keep it from ever closing.
+	//dup2 clears the flag on the copies a child uses as stdin/stdout
+	int res = pipe2(fd, O_CLOEXEC);
 	if(res == -1)
-		throw std::runtime_error("pipe() returned -1");
+		throw std::runtime_error("pipe2() returned -1");
 }
 
 Pipe::~Pipe() {
@@ -55,6 +58,7 @@ Process::Process(const std::string &command) : Process(command, {})
 
 Process::Process(const std::string &command,
                  const std::vector<std::string> &args)
+: eof(false)
 {
 	//convert the arguments into an exec friendly form
 	std::vector<const char *> c_args;
@@ -68,21 +72,27 @@ Process::Process(const std::string &command,
 	if(pid == -1)
 		throw std::runtime_error("fork returned -1");
 	if(!pid) {
-		/* Child process */
+		/* Child process
+		   This must never throw or return: whoever catches it would keep
+		   running a copy of the parent, holding its pipes and fds open */
 		/* Close unused pipes */
-		in.close(1); //input  write
-		out.close(0); //output read
+		::close(in[1]); //input  write
+		::close(out[0]); //output read
 		/* set up std io for pipes */
 		dup2(in[0],  STDIN_FILENO ); //set stdin  to read  channel of in
 		dup2(out[1], STDOUT_FILENO); //set stdout to write channel of out
 		dup2(out[1], STDERR_FILENO); //set stderr to write channel of out
 
 		/* execute program */
-		int res = execvp(command.c_str(),
-		                 const_cast<char * const *>(c_args.data()));
-        	throw std::runtime_error(std::string("execv returned ")
-	                         + std::to_string(res) + ": "
-	                         + strerror(errno));
+		execvp(command.c_str(), const_cast<char * const *>(c_args.data()));
+		//no allocations or exceptions from here on
+		const char *err = strerror(errno);
+		const char *parts[] = {"exec ", command.c_str(), " failed: ", err, "\n"};
+		for(const char *part : parts) {
+			if(::write(STDERR_FILENO, part, strlen(part)) == -1)
+				break;
+		}
+		_exit(127);
 	}
 	else {
 		/* Parent process */
@@ -137,21 +147,42 @@ bool Process::running() {
 	return running(dummy);
 }
 	
-/* TODO: handle blocking or incomplete writes */
-void Process::write(std::string input) {
-	set_blocking();
+void Process::set_input_blocking(bool blocking) {
+	int flags = fcntl(in[1], F_GETFL, 0);
+	if(flags == -1)
+		throw std::runtime_error("fcntl returned -1");
+	flags = blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK);
+	if(fcntl(in[1], F_SETFL, flags) == -1)
+		throw std::runtime_error("fcntl returned -1");
+}
+
+void Process::write(const std::string &input) {
+	set_input_blocking(true);
+	const char *data = input.data();
 	auto remaining = input.size();
 	while(remaining) {
-		auto count = ::write(in[1], input.c_str(), input.size());
+		auto count = ::write(in[1], data, remaining);
 		if(count == -1) {
 			throw std::runtime_error("Write returned -1 :(");
 		}
 		else {
+			data += count;
 			remaining -= count;
 		}
 	}
 }
 
+std::size_t Process::write_some(const char *data, std::size_t size) {
+	set_input_blocking(false);
+	auto count = ::write(in[1], data, size);
+	if(count == -1) {
+		if(errno == EAGAIN || errno == EWOULDBLOCK)
+			return 0;
+		throw std::runtime_error("Write returned -1 :(");
+	}
+	return count;
+}
+
 std::string Process::read_some() {
 	set_nonblocking();
 	return read();
@@ -162,35 +193,54 @@ std::string Process::read_all() {
 	return read();
 }
 
+std::size_t Process::read_into(char *buff, std::size_t size) {
+	auto count = ::read(out[0], buff, size);
+	if(count == 0) {
+		eof = true;
+		return 0;
+	}
+	else if(count == -1) {
+		if(errno == EAGAIN || errno == EWOULDBLOCK)
+			return 0;
+		throw std::runtime_error("read returned something unexpected");
+	}
+	return count;
+}
+
 std::string Process::read() {
+	//read straight into the result instead of through a separate buffer
 	std::string res;
-	const int block_size = 1024;
-	std::vector<char> buff(block_size);
+	const std::size_t block_size = 64 * 1024;
 	while(true) {
-		auto count = ::read(out[0], buff.data(), block_size);
-		if(count == 0) {
+		auto old_size = res.size();
+		res.resize(old_size + block_size);
+		auto count = read_into(&res[old_size], block_size);
+		res.resize(old_size + count);
+		if(!count)
 			break;
-        	}
-		else if(count == -1) {
-			if(errno == EAGAIN || errno == EWOULDBLOCK)
-				break;
-			else
-				throw std::runtime_error("read returned something unexpected");
-		}
-		else {
-			res.insert(std::end(res), std::begin(buff),
-			           std::begin(buff) + count);
-			continue;
-		}
 	}
 	return res;
 }
 
+bool Process::output_done() const {
+	return eof;
+}
+
+int Process::input_fd() {
+	return in[1];
+}
+
+int Process::output_fd() {
+	return out[0];
+}
+
 void Process::close_input() {
 	in.close(1);
 }
 
-void Process::wait() {
+int Process::wait() {
 	int res;
-	waitpid(pid, &res, 0);
+	if(waitpid(pid, &res, 0) == -1 || !WIFEXITED(res))
+		return -1;
+	return WEXITSTATUS(res);
 }
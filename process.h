@@ -11,7 +11,7 @@ class Pipe {
 	int fd[2];
 	bool open[2];
 public:
-	/* Construct a new pipe by calling the posix pipe() function */
+	/* Construct a new close-on-exec pipe by calling the posix pipe2() function */
 	Pipe();
 	/* calls close() */
 	~Pipe();
@@ -46,7 +46,11 @@ public:
 	bool running(int& ret_code);
 
 	/* Writes data to child's stdin */
-	void write(std::string input);
+	void write(const std::string &input);
+
+	/* Writes as much as fits in the pipe without blocking
+	   returns the number of bytes written */
+	std::size_t write_some(const char *data, std::size_t size);
 	
 	/* closes child's stdin, when there is no more input */
 	void close_input();
@@ -59,17 +63,33 @@ public:
     
 	/* Reads with current blocking mode*/
 	std::string read();
+
+	/* Reads up to size bytes into buff with current blocking mode
+	   returns 0 if nothing was pending or the output is done */
+	std::size_t read_into(char *buff, std::size_t size);
     
 	/* set read() to be non-blocking */
 	void set_nonblocking();
 	/* set read() to be blocking */
 	void set_blocking();
 
-	void wait();
+	/* Returns true once read() has seen the end of the child's output */
+	bool output_done() const;
+
+	/* Pipe ends for child's stdin and stdout, for use with poll/epoll */
+	int input_fd();
+	int output_fd();
+
+	/* Waits for the process to exit
+	   returns its exit status, or -1 if it didn't exit normally */
+	int wait();
 private:
+	void set_input_blocking(bool blocking);
+
 	int pid;
 	Pipe in;  //Write end of pipe
 	Pipe out; //Read end of pipe
+	bool eof;
 };
 
 #endif //MISSBLIT_PROCESS_H
@@ -11,8 +11,24 @@
 #include <string>
 #include <algorithm>
 #include <deque>
+#include <limits>
 #include "regex_tree_node.h"
 
+/* Escapes text (which can be any part of a regex) for use inside HTML */
+inline std::string html_escape(const std::string &text) {
+	std::string res;
+	for(char c : text) {
+		switch(c) {
+			case '<': res += "&lt;";   break;
+			case '>': res += "&gt;";   break;
+			case '&': res += "&amp;";  break;
+			case '"': res += "&quot;"; break;
+			default:  res += c;
+		}
+	}
+	return res;
+}
+
 /*
 Regex Grammar:
 	start -> regex EOF
@@ -54,12 +70,332 @@ struct dfa {
 	std::size_t size() const {
 		return accepting_.size();
 	}
-	
+
+	/* Which states can still reach an accepting state
+	   indexed up to and including the dead state (which is never live) */
+	std::vector<bool> live_states() const {
+		std::vector<std::vector<int>> rev(size());
+		std::vector<bool> live(size()+1);
+		std::vector<int> q;
+		for(std::size_t s = 0; s < size(); s++) {
+			for(const auto &p : transitions[s])
+				rev[p.second].push_back(s);
+			if(accepting_[s]) {
+				live[s] = true;
+				q.push_back(s);
+			}
+		}
+		while(!q.empty()) {
+			int a = q.back(); q.pop_back();
+			for(int b : rev[a]) {
+				if(!live[b]) {
+					live[b] = true;
+					q.push_back(b);
+				}
+			}
+		}
+		return live;
+	}
+
+	/* Returns a copy of the DFA with state order[i] renamed to i
+	   order must be a permutation of the states starting with 0 */
+	dfa renumber(const std::vector<int> &order) const {
+		if(order.size() != size() || order[0] != 0)
+			throw std::runtime_error("bad state order");
+		std::vector<int> id(size());
+		for(std::size_t i = 0; i < order.size(); i++)
+			id[order[i]] = i;
+		dfa res;
+		res.transitions.resize(size());
+		res.accepting_.resize(size());
+		for(std::size_t s = 0; s < size(); s++) {
+			for(const auto &p : transitions[s])
+				res.transitions[id[s]][p.first] = id[p.second];
+			res.accepting_[id[s]] = accepting_[s];
+		}
+		return res;
+	}
+
+	/* Depth first order from the start state, so that a state usually comes
+	   right after the one it is most often entered from. Successors with
+	   more incoming edges are visited first, and states that can't reach an
+	   accepting state are put at the very end where they're never touched */
+	std::vector<int> layout_order() const {
+		auto live = live_states();
+		std::vector<int> in_degree(size()+1);
+		for(const auto &m : transitions)
+		for(const auto &p : m)
+			in_degree[p.second]++;
+
+		std::vector<int> order;
+		std::vector<bool> placed(size());
+		std::vector<int> stack = {0};
+		while(!stack.empty()) {
+			int a = stack.back(); stack.pop_back();
+			if(placed[a])
+				continue;
+			placed[a] = true;
+			order.push_back(a);
+			std::vector<int> next;
+			for(const auto &p : transitions[a]) {
+				if(live[p.second] && !placed[p.second])
+					next.push_back(p.second);
+			}
+			//pushed coldest first so the hottest is popped next
+			std::stable_sort(std::begin(next), std::end(next),
+				[&](int x, int y) { return in_degree[x] < in_degree[y]; });
+			stack.insert(std::end(stack), std::begin(next), std::end(next));
+		}
+		for(std::size_t s = 0; s < size(); s++) {
+			if(!placed[s])
+				order.push_back(s);
+		}
+		return order;
+	}
+
+	/* Renumber states so that hot states are next to each other */
+	dfa layout() const {
+		return renumber(layout_order());
+	}
+
+	/* Profile guided version of the above: the DFA is run over `sample`
+	   (restarting whenever it dies) and the most visited states go first.
+	   Ties keep the static order. */
+	dfa layout(const std::string &sample) const {
+		auto live = live_states();
+		std::vector<long> visits(size());
+		int s = 0;
+		for(char c : sample) {
+			visits[s]++;
+			s = next(s, c);
+			if(!live[s])
+				s = 0;
+		}
+		auto order = layout_order();
+		std::stable_sort(std::begin(order) + 1, std::end(order),
+			[&](int x, int y) { return visits[x] > visits[y]; });
+		return renumber(order);
+	}
+
+	/* Builds a DFA for unanchored leftmost-longest search.
+	   Run from the search position until it dies, the last accepting
+	   position it passed is the end of the leftmost-longest match.
+
+	   Each of its states is the list of live threads (states of this DFA)
+	   ordered by where they started, earliest first, plus whether a match
+	   has been seen. A new thread starts at every position until something
+	   matches; after that threads which started later than the earliest
+	   matching one can't win anymore and are dropped. Two threads in the
+	   same state behave the same from then on, so only the earlier is kept.
+
+	   Throws if more than max_states states would be needed */
+	dfa leftmost_longest(std::size_t max_states = 10000) const {
+		auto live = live_states();
+		std::set<char> alphabet;
+		for(const auto &m : transitions)
+		for(const auto &p : m)
+			alphabet.insert(p.first);
+
+		typedef std::pair<std::vector<int>, bool> search_state;
+		//dedupe, drop dead threads, start a new one, and cut off after
+		//the first accepting thread
+		auto settle = [&](const std::vector<int> &threads, bool matched) {
+			search_state res = {{}, matched};
+			std::vector<bool> seen(size()+1);
+			auto add = [&](int t) {
+				if(!live[t] || seen[t])
+					return false;
+				seen[t] = true;
+				res.first.push_back(t);
+				if(accepting(t)) {
+					res.second = true;
+					return true;
+				}
+				return false;
+			};
+			for(int t : threads) {
+				if(add(t))
+					return res;
+			}
+			if(!matched)
+				add(0);
+			return res;
+		};
+
+		dfa res;
+		auto initial = settle({}, false);
+		std::map<search_state, int> state_id = {{initial, 0}};
+		std::deque<search_state> unmarked = {initial};
+		while(!unmarked.empty()) {
+			auto current = unmarked.front();
+			unmarked.pop_front();
+			const auto &threads = current.first;
+			std::map<char, int> S;
+			for(int c = -128; c < 128; c++) {
+				//outside the alphabet every thread dies
+				std::vector<int> moved;
+				if(alphabet.count(c)) {
+					for(int t : threads)
+						moved.push_back(next(t, c));
+				}
+				auto U = settle(moved, current.second);
+				if(U.first.empty())
+					continue; //dead state
+				if(!state_id.count(U)) {
+					if(state_id.size() >= max_states)
+						throw std::runtime_error("search DFA too big");
+					int id = state_id.size();
+					state_id[U] = id;
+					unmarked.push_back(U);
+				}
+				S[c] = state_id[U];
+			}
+			res.transitions.emplace_back(std::move(S));
+			res.accepting_.push_back(current.second && !threads.empty()
+			                         && accepting(threads.back()));
+		}
+		return res;
+	}
+
+	enum class set_op {unite, intersect, subtract};
+
+	/* Product construction, running this DFA and `other` side by side.
+	   Only pairs reachable from (0, 0) are built, and pairs from which the
+	   result can't accept anymore are left out as the dead state. */
+	dfa product(const dfa &other, set_op op) const {
+		auto live_a = live_states();
+		auto live_b = other.live_states();
+		std::set<char> alpha_a, alpha_b, alphabet;
+		for(const auto &m : transitions)
+		for(const auto &p : m)
+			alpha_a.insert(p.first);
+		for(const auto &m : other.transitions)
+		for(const auto &p : m)
+			alpha_b.insert(p.first);
+		for(char c : alpha_a) {
+			if(op != set_op::intersect || alpha_b.count(c))
+				alphabet.insert(c);
+		}
+		if(op == set_op::unite)
+			alphabet.insert(std::begin(alpha_b), std::end(alpha_b));
+
+		auto alive = [&](int a, int b) {
+			switch(op) {
+				case set_op::unite:     return live_a[a] || live_b[b];
+				case set_op::intersect: return live_a[a] && live_b[b];
+				default:                return bool(live_a[a]);
+			}
+		};
+		auto accepts = [&](int a, int b) {
+			switch(op) {
+				case set_op::unite:     return accepting(a) || other.accepting(b);
+				case set_op::intersect: return accepting(a) && other.accepting(b);
+				default:                return accepting(a) && !other.accepting(b);
+			}
+		};
+
+		dfa res;
+		std::pair<int, int> initial = {0, 0};
+		std::map<std::pair<int, int>, int> state_id = {{initial, 0}};
+		std::deque<std::pair<int, int>> unmarked = {initial};
+		while(!unmarked.empty()) {
+			auto current = unmarked.front();
+			unmarked.pop_front();
+			std::map<char, int> S;
+			if(alive(current.first, current.second)) {
+				for(char c : alphabet) {
+					std::pair<int, int> U = {next(current.first, c),
+					                         other.next(current.second, c)};
+					if(!alive(U.first, U.second))
+						continue;
+					if(!state_id.count(U)) {
+						int id = state_id.size();
+						state_id[U] = id;
+						unmarked.push_back(U);
+					}
+					S[c] = state_id[U];
+				}
+			}
+			res.transitions.emplace_back(std::move(S));
+			res.accepting_.push_back(accepts(current.first, current.second));
+		}
+		return res;
+	}
+
+	/* Set operations on the accepted languages
+	   Results are minimized, so chaining them stays small */
+	dfa union_with(const dfa &other) const {
+		return product(other, set_op::unite).minimize();
+	}
+	dfa intersection(const dfa &other) const {
+		return product(other, set_op::intersect).minimize();
+	}
+	dfa difference(const dfa &other) const {
+		return product(other, set_op::subtract).minimize();
+	}
+
+	/* Accepts every byte string this DFA rejects
+	   The implicit dead state becomes an explicit accepting sink,
+	   so every state gets all 256 transitions */
+	dfa complement() const {
+		dfa res;
+		res.transitions.resize(size()+1);
+		for(std::size_t s = 0; s <= size(); s++) {
+			for(int c = -128; c < 128; c++)
+				res.transitions[s][c] = next(s, c);
+			res.accepting_.push_back(!accepting(s));
+		}
+		return res.minimize();
+	}
+
+	/* Plain text form, "dfa <states>" and then one line per state:
+	   "<accepting> <edges> <byte>:<target> ..." with bytes as numbers */
+	void serialize(std::ostream &out) const {
+		out << "dfa " << size() << "\n";
+		for(std::size_t s = 0; s < size(); s++) {
+			out << accepting_[s] << " " << transitions[s].size();
+			for(const auto &p : transitions[s])
+				out << " " << int(static_cast<unsigned char>(p.first))
+				    << ":" << p.second;
+			out << "\n";
+		}
+	}
+
+	static dfa deserialize(std::istream &in) {
+		std::string magic;
+		std::size_t states;
+		if(!(in >> magic >> states) || magic != "dfa")
+			throw std::runtime_error("not a serialized dfa");
+		dfa res;
+		res.transitions.resize(states);
+		for(std::size_t s = 0; s < states; s++) {
+			int accepting, edges;
+			if(!(in >> accepting >> edges))
+				throw std::runtime_error("truncated dfa");
+			res.accepting_.push_back(accepting);
+			for(int e = 0; e < edges; e++) {
+				int byte, target;
+				char colon;
+				if(!(in >> byte >> colon >> target) || colon != ':'
+				   || byte < 0 || byte > 255
+				   || target < 0 || std::size_t(target) >= states)
+					throw std::runtime_error("bad dfa edge");
+				res.transitions[s][static_cast<char>(byte)] = target;
+			}
+		}
+		return res;
+	}
+
 	std::string graph() const {
+		std::stringstream ss;
+		graph(ss);
+		return ss.str();
+	}
+	/* Writes the graph to ss as it goes, so big graphs can be streamed */
+	void graph(std::ostream &ss) const {
 		std::set<int> visited = {0};
 		std::vector<int> q = {0};
 		
-		std::stringstream ss;
 		ss << "digraph G {\n\tgraph [ordering=\"out\" overlap=scale splines=true];\nrankdir=LR;\n";
 		while(!q.empty()) {
 			int a = q.back(); q.pop_back();
@@ -73,12 +409,13 @@ struct dfa {
 					q.push_back(p.second);
 					visited.insert(p.second);
 				}
-				ss << "\t" << a << " -> " << p.second
-				   << " [label=\"" << p.first << "\"];\n";
+				ss << "\t" << a << " -> " << p.second << " [label=\"";
+				if(p.first == '"' || p.first == '\\')
+					ss << '\\';
+				ss << p.first << "\"];\n";
 			}
 		}
 		ss << "}\n";
-		return ss.str();
 	}
 
 	int &distinct(int s1, int s2, std::vector<std::vector<int>> &table) const
@@ -201,12 +538,15 @@ private:
 	std::unique_ptr<node> root;
 	
 	
-public:
-	/* DFA construction algorithm from dragon book 2nd ed. figure 3.62 */
-	dfa construct_dfa() {
+private:
+	/* DFA construction algorithm from dragon book 2nd ed. figure 3.62
+	   `follow` gives the followpos set of a position
+	   throws if more than max_states states would be needed */
+	template<class Follow>
+	static dfa build_dfa(const std::set<node*> &initial, Follow follow,
+	                     std::size_t max_states) {
 		dfa res;
 
-		auto initial = root.get()->firstpos();
 		int current_state = 0;
 
 		//Mapping from sets of positions (states) to numeric ids
@@ -234,7 +574,7 @@ public:
 				}
 				else {
 					char letter = ln->letter();
-					auto fp = n->followpos();
+					auto fp = follow(n);
 					u_map[letter].insert(std::begin(fp), std::end(fp));
 				}
 			}
@@ -244,6 +584,8 @@ public:
                 
 				//Add U as new state to Dstates
 				if(state_id.count(U) == 0) {
+					if(state_id.size() >= max_states)
+						throw std::runtime_error("DFA too big");
 					state_id[U] = current_state++;
 					unmarked.push_back(U);
 				}
@@ -258,9 +600,61 @@ public:
 		}		
 		return res;
 	}
+
+public:
+	static const std::size_t no_limit = std::numeric_limits<std::size_t>::max();
+
+	/* The parsed expression, without the end marker */
+	node *expression() {
+		return root->child(0);
+	}
+
+	/* The positions a match starts from, i.e. the initial DFA state */
+	std::set<node*> start_positions() {
+		return root->firstpos();
+	}
+
+	dfa construct_dfa(std::size_t max_states = no_limit) {
+		return build_dfa(start_positions(),
+		                 [](node *n) { return n->followpos(); }, max_states);
+	}
+
+	/* The same construction over the reversed expression, for running
+	   backwards from the end of a match to find its start.
+	   followpos is turned around and first and last positions trade places.
+	   The terminator stays the end marker, now following the old firstpos */
+	dfa construct_reverse_dfa(std::size_t max_states = no_limit) {
+		node *r = root->child(0);
+		node *end_marker = root->child(1);
+		std::map<node*, std::set<node*>> rev_follow;
+		std::vector<node*> pending = {r};
+		while(!pending.empty()) {
+			node *n = pending.back(); pending.pop_back();
+			for(int i = 0; i < n->num_children(); i++)
+				pending.push_back(n->child(i));
+			if(n->num_children() == 0 && dynamic_cast<letter_node*>(n)) {
+				for(node *f : n->followpos()) {
+					if(f != end_marker)
+						rev_follow[f].insert(n);
+				}
+			}
+		}
+		for(node *f : r->firstpos())
+			rev_follow[f].insert(end_marker);
+
+		auto initial = r->lastpos();
+		if(r->nullable())
+			initial.insert(end_marker);
+		return build_dfa(initial, [&](node *n) { return rev_follow[n]; },
+		                 max_states);
+	}
 		
 	std::string graph() {
 		std::stringstream ss;
+		graph(ss);
+		return ss.str();
+	}
+	void graph(std::ostream &ss) {
 		ss << "digraph G {\n\tgraph [ordering=\"out\"];\n";
  		std::vector<node*> pending = {root.get()};
 		while(!pending.empty()) {
@@ -289,8 +683,8 @@ public:
 			}
 			followpos_str += "}";			
 			
-			ss << long(n) << " [label=<" << n->to_string() << "<BR />\n"
-			                 "<FONT POINT-SIZE=\"10\">"
+			ss << long(n) << " [label=<" << html_escape(n->to_string())
+			   << "<BR />\n<FONT POINT-SIZE=\"10\">"
 			   << firstpos_str << "<BR />\n" << lastpos_str << "<BR />"
 			   << followpos_str << "</FONT>>];\n";
 			for(int i = 0; i < n->num_children(); i++) {
@@ -299,7 +693,6 @@ public:
 			}
 		}
 		ss << "}\n";
-		return ss.str();
 	}	
 					
 	//peek at the current symbol without consuming it
@@ -366,6 +759,9 @@ public:
 
 	std::unique_ptr<node> expr() {
 		auto left = term();
+		//nothing to match here, e.g. the empty alternative in "a|"
+		if(!left)
+			return std::make_unique<empty_node>();
 		std::unique_ptr<node> right;
 		while((right = term())) {
 			left = std::make_unique<cat_node>(std::move(left),
@@ -0,0 +1,188 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "render_cache.h"
+
+/* Bump this whenever rendering changes, so old entries (and browsers'
+   copies, through the ETag) stop being used */
+static const char *render_version = "2";
+
+//several writers for the same key can be open at once
+static std::atomic<unsigned> tmp_count(0);
+
+render_cache::entry::entry(void *map_, std::size_t map_size_)
+: map(map_), map_size(map_size_)
+{
+	auto begin = static_cast<const char*>(map);
+	auto newline = static_cast<const char*>(std::memchr(begin, '\n', map_size));
+	header_size = newline ? newline - begin + 1 : map_size;
+}
+
+render_cache::entry::~entry() {
+	munmap(map, map_size);
+}
+
+std::string render_cache::entry::content_type() const {
+	return std::string(static_cast<const char*>(map),
+	                   header_size ? header_size - 1 : 0);
+}
+
+const char *render_cache::entry::data() const {
+	return static_cast<const char*>(map) + header_size;
+}
+
+std::size_t render_cache::entry::size() const {
+	return map_size - header_size;
+}
+
+
+render_cache::writer::writer(render_cache &cache_, const std::string &key_,
+                             const std::string &content_type)
+: cache(cache_), key(key_),
+  tmp(cache.path(key) + ".tmp" + std::to_string(getpid()) + "."
+      + std::to_string(tmp_count++))
+{
+	file = std::fopen(tmp.c_str(), "wb");
+	if(!file)
+		throw std::runtime_error("can't write cache file " + tmp);
+	ok = std::fprintf(file, "%s\n", content_type.c_str()) > 0;
+	size = content_type.size() + 1;
+}
+
+render_cache::writer::~writer() {
+	if(file) {
+		std::fclose(file);
+		unlink(tmp.c_str());
+	}
+}
+
+void render_cache::writer::write(const char *data, std::size_t count) {
+	ok = ok && std::fwrite(data, 1, count, file) == count;
+	size += count;
+}
+
+void render_cache::writer::commit() {
+	ok = (std::fclose(file) == 0) && ok;
+	file = nullptr;
+	if(!ok || std::rename(tmp.c_str(), cache.path(key).c_str()) == -1) {
+		unlink(tmp.c_str());
+		throw std::runtime_error("can't write cache file " + tmp);
+	}
+	cache.add(key, size);
+}
+
+
+render_cache::render_cache(const std::string &dir_, std::size_t max_bytes_)
+: dir(dir_), max_bytes(max_bytes_), total_bytes(0)
+{
+	if(mkdir(dir.c_str(), 0755) == -1 && errno != EEXIST)
+		throw std::runtime_error("can't create cache directory " + dir);
+	DIR *d = opendir(dir.c_str());
+	if(!d)
+		throw std::runtime_error("can't open cache directory " + dir);
+	while(dirent *e = readdir(d)) {
+		std::string name = e->d_name;
+		struct stat st;
+		if(name[0] == '.' || stat(path(name).c_str(), &st) == -1)
+			continue;
+		//leftovers from a crash in the middle of store()
+		if(name.find(".tmp") != std::string::npos) {
+			unlink(path(name).c_str());
+			continue;
+		}
+		files[name] = {std::size_t(st.st_size), st.st_mtime};
+		total_bytes += st.st_size;
+	}
+	closedir(d);
+	std::lock_guard<std::mutex> lock(mutex);
+	evict();
+}
+
+std::string render_cache::key(const std::string &regex, const std::string &mode,
+                              const std::string &format)
+{
+	//the handler treats anything it doesn't know as the default
+	std::string normalized = std::string(render_version) + '\0' + regex + '\0'
+	                       + (mode == "dfa" ? "dfa" : "tree") + '\0'
+	                       + (format == "text" ? "text" : "png");
+	//64 bit FNV-1a
+	std::uint64_t hash = 14695981039346656037ull;
+	for(char c : normalized) {
+		hash ^= static_cast<unsigned char>(c);
+		hash *= 1099511628211ull;
+	}
+	char hex[17];
+	std::snprintf(hex, sizeof hex, "%016llx", (unsigned long long)hash);
+	return hex;
+}
+
+std::string render_cache::path(const std::string &name) const {
+	return dir + "/" + name;
+}
+
+std::unique_ptr<render_cache::entry> render_cache::find(const std::string &key)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto f = files.find(key);
+		if(f == std::end(files))
+			return nullptr;
+		f->second.last_used = std::time(nullptr);
+	}
+	int fd = open(path(key).c_str(), O_RDONLY);
+	if(fd == -1)
+		return nullptr; //evicted in the meantime
+	struct stat st;
+	void *map = MAP_FAILED;
+	if(fstat(fd, &st) != -1 && st.st_size > 0)
+		map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	//updating the mtime keeps the LRU order across restarts
+	futimens(fd, nullptr);
+	close(fd);
+	if(map == MAP_FAILED)
+		return nullptr;
+	return std::make_unique<entry>(map, st.st_size);
+}
+
+void render_cache::store(const std::string &key,
+                         const std::string &content_type,
+                         const std::string &body)
+{
+	writer w(*this, key, content_type);
+	w.write(body.data(), body.size());
+	w.commit();
+}
+
+void render_cache::add(const std::string &key, std::size_t size) {
+	std::lock_guard<std::mutex> lock(mutex);
+	auto old = files.find(key);
+	if(old != std::end(files))
+		total_bytes -= old->second.size;
+	files[key] = {size, std::time(nullptr)};
+	total_bytes += size;
+	evict();
+}
+
+//must be called with the mutex held
+void render_cache::evict() {
+	while(total_bytes > max_bytes && !files.empty()) {
+		auto oldest = std::min_element(std::begin(files), std::end(files),
+			[](const std::pair<const std::string, file_info> &a,
+			   const std::pair<const std::string, file_info> &b) {
+				return a.second.last_used < b.second.last_used;
+			});
+		unlink(path(oldest->first).c_str());
+		total_bytes -= oldest->second.size;
+		files.erase(oldest);
+	}
+}
@@ -0,0 +1,99 @@
+#ifndef MISSBLIT_RENDER_CACHE_H
+#define MISSBLIT_RENDER_CACHE_H
+
+#include <cstddef>
+#include <cstdio>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+/* Persistent on-disk cache of rendered output
+ *
+ * Renders are fully determined by the (normalized) query, so each one is
+ * stored in a file named after a hash of it. That hash doubles as the ETag.
+ * Files are written to a temporary name and renamed into place so a crash
+ * never leaves a half written entry, and hits are served straight from an
+ * mmap of the file.
+ *
+ * When the total size goes over the limit the least recently used entries
+ * are deleted. Use times are kept in the files' mtime so they survive
+ * restarts.
+ */
+class render_cache {
+public:
+	/* A cached render, mapped into memory for as long as this lives */
+	class entry {
+	public:
+		entry(void *map, std::size_t map_size);
+		~entry();
+		entry(const entry &) = delete;
+		entry &operator=(const entry &) = delete;
+
+		std::string content_type() const;
+		const char *data() const;
+		std::size_t size() const;
+	private:
+		void *map;
+		std::size_t map_size;
+		//content type line ends here, the body starts after it
+		std::size_t header_size;
+	};
+
+	/* Writes a render into the cache piece by piece as it is produced
+	   Nothing shows up in the cache until commit(), a writer destroyed
+	   before that throws its temporary file away */
+	class writer {
+	public:
+		writer(render_cache &cache, const std::string &key,
+		       const std::string &content_type);
+		~writer();
+		writer(const writer &) = delete;
+		writer &operator=(const writer &) = delete;
+
+		void write(const char *data, std::size_t size);
+		/* Moves the finished file into place, evicting old entries if needed */
+		void commit();
+	private:
+		render_cache &cache;
+		std::string key;
+		std::string tmp;
+		FILE *file;
+		std::size_t size;
+		bool ok;
+	};
+
+	/* Opens (creating if needed) the cache directory and indexes whatever
+	   is already in it */
+	render_cache(const std::string &dir, std::size_t max_bytes);
+
+	/* Cache key for a query, also used as its ETag */
+	static std::string key(const std::string &regex, const std::string &mode,
+	                       const std::string &format);
+
+	/* Returns the entry for key, or nullptr on a miss */
+	std::unique_ptr<entry> find(const std::string &key);
+
+	/* Stores a render under key, evicting old entries if needed */
+	void store(const std::string &key, const std::string &content_type,
+	           const std::string &body);
+
+private:
+	struct file_info {
+		std::size_t size;
+		std::time_t last_used;
+	};
+
+	std::string path(const std::string &key) const;
+	void add(const std::string &key, std::size_t size);
+	void evict();
+
+	std::string dir;
+	std::size_t max_bytes;
+	std::size_t total_bytes;
+	std::map<std::string, file_info> files;
+	std::mutex mutex;
+};
+
+#endif //MISSBLIT_RENDER_CACHE_H
@@ -0,0 +1,483 @@
+#ifndef MBLIT_RULE_SET_H
+#define MBLIT_RULE_SET_H
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "regex_tree.h"
+
+/* A set of token rules compiled into one lexer DFA, updated in place
+ *
+ * The DFA for rules r0|r1|... is the usual followpos construction over the
+ * union of the rules' positions, so every state is a set of positions from
+ * one or more rules. Transitions of a state only depend on its positions,
+ * and positions of one rule only ever lead to positions of the same rule.
+ * That gives cheap updates:
+ *   add     the new rule's positions aren't in any existing state, so only
+ *           sets that come up for the first time (starting with the new
+ *           initial state) have to be built, everything else is looked up
+ *   remove  only the states holding one of the rule's positions change,
+ *           they are dropped and rebuilt from the new initial state
+ * States keep their slot across updates, unreachable ones are reclaimed.
+ *
+ * Kept states also keep their equivalence class, since their language didn't
+ * change. Minimization only has to place the new states, either into one of
+ * the existing classes or into new ones, and never looks at kept states
+ * beyond the classes they lead to.
+ *
+ * In the resulting DFAs accepting_[s] is 0 for non-accepting states and
+ * 1 + the id of the first (lowest id) rule matching otherwise.
+ */
+class rule_set {
+public:
+	struct update_stats {
+		//states looked up from earlier updates
+		std::size_t reused = 0;
+		//states whose position sets had to be built
+		std::size_t built = 0;
+	};
+
+	/* Starts out with no rules, matching nothing */
+	rule_set() {
+		rebuild();
+	}
+	rule_set(const rule_set &) = delete;
+	rule_set &operator=(const rule_set &) = delete;
+
+	/* Adds pattern as a new alternative and returns its id
+	   ids are never reused, so lower ids were added earlier */
+	int add(const std::string &pattern) {
+		rule r;
+		r.tree = std::make_unique<regex_tree>(pattern);
+		r.start = r.tree->start_positions();
+		//the start picks up the terminator if nothing else does
+		r.positions = r.start;
+		std::vector<node*> pending = {r.tree->expression()};
+		while(!pending.empty()) {
+			node *n = pending.back(); pending.pop_back();
+			for(int i = 0; i < n->num_children(); i++)
+				pending.push_back(n->child(i));
+			if(n->num_children() == 0 && dynamic_cast<letter_node*>(n)) {
+				auto fp = n->followpos();
+				r.positions.insert(n);
+				r.positions.insert(std::begin(fp), std::end(fp));
+			}
+		}
+		int id = next_rule++;
+		for(node *n : r.positions)
+			owner[n] = id;
+		rules[id] = std::move(r);
+		rebuild();
+		return id;
+	}
+
+	/* Removes the rule with the given id */
+	void remove(int id) {
+		auto r = rules.find(id);
+		if(r == std::end(rules))
+			throw std::runtime_error("no such rule");
+		for(int s : rule_states[id])
+			release(s, id);
+		rule_states.erase(id);
+		for(node *n : r->second.positions)
+			owner.erase(n);
+		rules.erase(r);
+		rebuild();
+	}
+
+	/* What the last add() or remove() had to do */
+	const update_stats &last_update() const {
+		return stats;
+	}
+
+	/* The DFA as built, without minimization */
+	dfa automaton() const {
+		std::vector<int> order = reachable();
+		std::map<int, int> id;
+		for(int s : order) {
+			int i = id.size();
+			id[s] = i;
+		}
+		dfa res;
+		for(int s : order) {
+			std::map<char, int> S;
+			for(const auto &p : states[s].next)
+				S[p.first] = id[p.second];
+			res.transitions.emplace_back(std::move(S));
+			res.accepting_.push_back(states[s].accepts);
+		}
+		return res;
+	}
+
+	/* The minimal DFA, one state per class
+	   unlike dfa::minimize() there is no explicit dead state */
+	dfa minimized() const {
+		std::map<int, int> id = {{states[start].cls, 0}};
+		std::vector<int> order = {states[start].cls};
+		dfa res;
+		for(std::size_t i = 0; i < order.size(); i++) {
+			const state &st = states[*classes.at(order[i]).members.begin()];
+			std::map<char, int> S;
+			for(const auto &p : st.next) {
+				int c = states[p.second].cls;
+				if(!id.count(c)) {
+					int n = id.size();
+					id[c] = n;
+					order.push_back(c);
+				}
+				S[p.first] = id[c];
+			}
+			res.transitions.emplace_back(std::move(S));
+			res.accepting_.push_back(st.accepts);
+		}
+		return res;
+	}
+
+private:
+	struct rule {
+		std::unique_ptr<regex_tree> tree;
+		std::set<node*> start;
+		std::set<node*> positions;
+	};
+
+	//accepts, then the class (or block) reached on each letter
+	typedef std::pair<int, std::vector<std::pair<char, int>>> signature;
+
+	struct class_info {
+		std::set<int> members;
+		signature sig;
+	};
+
+	struct state {
+		std::set<node*> positions;
+		//rules with a position in this state
+		std::set<int> rules;
+		std::map<char, int> next;
+		int accepts;
+		//equivalence class, -1 until placed by minimize()
+		int cls;
+	};
+
+	//slot of the state for positions, creating it if needed
+	int intern(const std::set<node*> &positions, std::vector<int> &fresh) {
+		auto found = slot_of.find(positions);
+		if(found != std::end(slot_of))
+			return found->second;
+		state st = {positions, {}, {}, 0, -1};
+		for(node *n : positions) {
+			int r = owner.at(n);
+			st.rules.insert(r);
+			if(static_cast<letter_node*>(n)->is_terminator()
+			   && (!st.accepts || r + 1 < st.accepts))
+				st.accepts = r + 1;
+		}
+		int s;
+		if(free_slots.empty()) {
+			s = states.size();
+			states.push_back(std::move(st));
+		} else {
+			s = free_slots.back();
+			free_slots.pop_back();
+			states[s] = std::move(st);
+		}
+		used.resize(states.size());
+		used[s] = true;
+		slot_of[positions] = s;
+		for(int r : states[s].rules)
+			rule_states[r].insert(s);
+		fresh.push_back(s);
+		return s;
+	}
+
+	//forget state s, except in rule_states[skip] which the caller clears
+	void release(int s, int skip = -1) {
+		for(int r : states[s].rules) {
+			if(r != skip)
+				rule_states[r].erase(s);
+		}
+		slot_of.erase(states[s].positions);
+		int c = states[s].cls;
+		if(c != -1) {
+			classes[c].members.erase(s);
+			if(classes[c].members.empty())
+				drop_class(c);
+		}
+		states[s] = state();
+		used[s] = false;
+		free_slots.push_back(s);
+	}
+
+	//live states in breadth first order from the start
+	std::vector<int> reachable() const {
+		std::vector<int> order = {start};
+		std::vector<bool> seen(states.size());
+		seen[start] = true;
+		for(std::size_t i = 0; i < order.size(); i++) {
+			for(const auto &p : states[order[i]].next) {
+				if(!seen[p.second]) {
+					seen[p.second] = true;
+					order.push_back(p.second);
+				}
+			}
+		}
+		return order;
+	}
+
+	/* Subset construction from the current initial state, only expanding
+	   position sets that aren't known yet */
+	void rebuild() {
+		std::set<node*> initial;
+		for(const auto &r : rules)
+			initial.insert(std::begin(r.second.start), std::end(r.second.start));
+		std::vector<int> fresh;
+		start = intern(initial, fresh);
+		for(std::size_t i = 0; i < fresh.size(); i++) {
+			int s = fresh[i];
+			std::map<char, std::set<node*>> u_map;
+			for(node *n : states[s].positions) {
+				letter_node *ln = static_cast<letter_node*>(n);
+				if(ln->is_terminator())
+					continue;
+				auto fp = n->followpos();
+				u_map[ln->letter()].insert(std::begin(fp), std::end(fp));
+			}
+			for(auto &u_pair : u_map) {
+				//intern may grow states, so don't hold on to states[s]
+				int t = intern(u_pair.second, fresh);
+				states[s].next[u_pair.first] = t;
+			}
+		}
+
+		//whatever the new start can't reach is garbage now
+		auto live = reachable();
+		std::vector<bool> keep(states.size());
+		for(int s : live)
+			keep[s] = true;
+		for(std::size_t s = 0; s < states.size(); s++) {
+			if(used[s] && !keep[s])
+				release(s);
+		}
+		fresh.erase(std::remove_if(std::begin(fresh), std::end(fresh),
+			[&](int s) { return !keep[s]; }), std::end(fresh));
+
+		stats.built = fresh.size();
+		stats.reused = live.size() - fresh.size();
+		minimize(fresh);
+	}
+
+	/* Places the new states into classes. Kept classes are exact (no two
+	   are equivalent) and their signatures, accepts plus the class reached
+	   on each letter, identify them. So a new state
+	   - whose targets all have classes is looked up by signature
+	   - that leads to a state equivalent to no kept class is new as well
+	   - otherwise is on a cycle of new states, and is matched against kept
+	     classes of the same shape by walking both in step
+	   The states that turn out new are then split Moore style among
+	   themselves, with everything else as fixed targets */
+	void minimize(const std::vector<int> &fresh) {
+		std::map<int, int> item;
+		for(std::size_t i = 0; i < fresh.size(); i++)
+			item[fresh[i]] = i;
+
+		//class of each new state: a kept one, -1 undecided or is_new
+		const int is_new = -2;
+		std::vector<int> found(fresh.size(), -1);
+		auto target_cls = [&](int t) {
+			int c = states[t].cls;
+			return c != -1 ? c : found[item[t]];
+		};
+
+		bool progress = true;
+		while(progress) {
+			progress = false;
+			for(std::size_t i = 0; i < fresh.size(); i++) {
+				if(found[i] != -1)
+					continue;
+				signature sig;
+				sig.first = states[fresh[i]].accepts;
+				int blocked = 0;
+				for(const auto &p : states[fresh[i]].next) {
+					int c = target_cls(p.second);
+					if(c < 0) {
+						blocked = c;
+						break;
+					}
+					sig.second.emplace_back(p.first, c);
+				}
+				if(blocked == -1)
+					continue;
+				if(blocked == is_new) {
+					found[i] = is_new;
+				} else {
+					auto c = class_of.find(sig);
+					found[i] = c != std::end(class_of) ? c->second : is_new;
+				}
+				progress = true;
+			}
+		}
+
+		for(std::size_t i = 0; i < fresh.size(); i++) {
+			if(found[i] != -1)
+				continue;
+			auto candidates = by_shape.find(shape(fresh[i]));
+			if(candidates != std::end(by_shape)) {
+				for(int c : candidates->second) {
+					std::map<int, int> pairs;
+					if(same_language(i, c, fresh, item, found, pairs)) {
+						for(const auto &p : pairs)
+							found[p.first] = p.second;
+						break;
+					}
+				}
+			}
+			if(found[i] == -1)
+				found[i] = is_new;
+		}
+
+		//targets are encoded as blocks of new states, or -1 - class
+		std::vector<int> split;
+		for(std::size_t i = 0; i < fresh.size(); i++) {
+			if(found[i] == is_new)
+				split.push_back(i);
+		}
+		std::vector<int> block(fresh.size());
+		for(int i : split)
+			block[i] = states[fresh[i]].accepts;
+		std::size_t blocks = 0;
+		std::map<signature, int> block_id;
+		while(true) {
+			block_id.clear();
+			std::vector<int> refined(fresh.size());
+			for(int i : split) {
+				signature sig;
+				sig.first = block[i];
+				for(const auto &p : states[fresh[i]].next) {
+					int c = target_cls(p.second);
+					sig.second.emplace_back(p.first,
+						c == is_new ? block[item[p.second]] : -1 - c);
+				}
+				auto b = block_id.find(sig);
+				if(b == std::end(block_id))
+					b = block_id.insert({sig, int(block_id.size())}).first;
+				refined[i] = b->second;
+			}
+			block.swap(refined);
+			//refining never merges, so the same count means nothing split
+			if(block_id.size() == blocks)
+				break;
+			blocks = block_id.size();
+		}
+		int first_new = next_class;
+		next_class += blocks;
+		for(int i : split)
+			found[i] = first_new + block[i];
+		for(int i : split) {
+			if(classes.count(found[i]))
+				continue;
+			signature sig;
+			sig.first = states[fresh[i]].accepts;
+			for(const auto &p : states[fresh[i]].next)
+				sig.second.emplace_back(p.first, target_cls(p.second));
+			add_class(found[i], sig);
+		}
+		for(std::size_t i = 0; i < fresh.size(); i++) {
+			states[fresh[i]].cls = found[i];
+			classes[found[i]].members.insert(fresh[i]);
+		}
+	}
+
+	/* Walks new state i and kept class c in step, pairing up the undecided
+	   states reached on the way with classes. Succeeds if the pairing is
+	   consistent, which makes every pair equivalent */
+	bool same_language(int i, int c, const std::vector<int> &fresh,
+	                   std::map<int, int> &item, const std::vector<int> &found,
+	                   std::map<int, int> &pairs)
+	{
+		std::vector<std::pair<int, int>> pending = {{i, c}};
+		pairs[i] = c;
+		while(!pending.empty()) {
+			const state &a = states[fresh[pending.back().first]];
+			const class_info &ci = classes.at(pending.back().second);
+			pending.pop_back();
+			if(a.accepts != ci.sig.first || a.next.size() != ci.sig.second.size())
+				return false;
+			auto e = std::begin(ci.sig.second);
+			for(const auto &p : a.next) {
+				if(p.first != e->first)
+					return false;
+				int t = states[p.second].cls;
+				if(t == -1) {
+					int j = item[p.second];
+					t = found[j];
+					if(t == -1) {
+						auto paired = pairs.find(j);
+						if(paired == std::end(pairs)) {
+							pairs[j] = e->second;
+							pending.push_back({j, e->second});
+						}
+						t = pairs[j];
+					}
+				}
+				if(t != e->second)
+					return false;
+				++e;
+			}
+		}
+		return true;
+	}
+
+	std::pair<int, std::string> shape(int s) const {
+		std::string letters;
+		for(const auto &p : states[s].next)
+			letters += p.first;
+		return {states[s].accepts, letters};
+	}
+
+	void add_class(int c, const signature &sig) {
+		classes[c].sig = sig;
+		class_of[sig] = c;
+		std::string letters;
+		for(const auto &p : sig.second)
+			letters += p.first;
+		by_shape[{sig.first, letters}].insert(c);
+	}
+
+	//called when the last member of class c is gone
+	void drop_class(int c) {
+		const signature &sig = classes[c].sig;
+		std::string letters;
+		for(const auto &p : sig.second)
+			letters += p.first;
+		auto &same_shape = by_shape[{sig.first, letters}];
+		same_shape.erase(c);
+		if(same_shape.empty())
+			by_shape.erase({sig.first, letters});
+		class_of.erase(sig);
+		classes.erase(c);
+	}
+
+	std::map<int, rule> rules;
+	//which rule each position belongs to
+	std::map<node*, int> owner;
+	//states holding positions of each rule
+	std::map<int, std::set<int>> rule_states;
+	std::vector<state> states;
+	std::vector<bool> used;
+	std::vector<int> free_slots;
+	std::map<std::set<node*>, int> slot_of;
+	std::map<int, class_info> classes;
+	//kept classes by signature, and by accepts plus letters
+	std::map<signature, int> class_of;
+	std::map<std::pair<int, std::string>, std::set<int>> by_shape;
+	int start = -1;
+	int next_rule = 0;
+	int next_class = 0;
+	update_stats stats;
+};
+
+#endif //MBLIT_RULE_SET_H
@@ -0,0 +1,401 @@
+#ifndef MBLIT_SCANNER_H
+#define MBLIT_SCANNER_H
+
+#include <cstdint>
+#include <iterator>
+#include <string>
+#include <vector>
+#include "regex_tree.h"
+#include "prefilter.h"
+
+/* A DFA compiled for running over input buffers.
+ * The map based transitions in `dfa` are flattened into a 256 entry row per
+ * state, and every state that can no longer reach an accepting state is
+ * pointed at the dead state so a failed attempt stops as early as possible.
+ *
+ * State ids in the table are stored in the narrowest type that fits (8, 16 or
+ * 32 bits), so a DFA of up to 255 states takes 64KB and stays in L2. Running
+ * the DFA through dfa::layout() first keeps the hot rows next to each other
+ * (scanner does that for the DFAs it builds itself).
+ *
+ * States that loop back to themselves on all but a few bytes are marked as
+ * accelerable. Instead of stepping those one byte at a time the forward walks
+ * do a vectorized search for the first byte that leaves the state.
+ */
+class dfa_table {
+public:
+	/* How to skip over the bytes that keep a state where it is */
+	struct accel {
+		enum class kind {
+			none,   //step normally
+			escape, //`bytes` are the only ones that leave the state (if
+			        //there are none it loops on everything)
+			span    //`bytes` are the only ones that stay in the state
+		};
+		kind k = kind::none;
+		std::string bytes;
+	};
+
+private:
+	//row-major transition tables, row `dead_` is the dead state
+	//only the one matching width_ is filled in
+	std::vector<std::uint8_t>  table8_;
+	std::vector<std::uint16_t> table16_;
+	std::vector<std::uint32_t> table32_;
+	int width_;
+	std::vector<bool> accepting_;
+	std::vector<accel> accel_;
+	int dead_;
+
+	template<class T>
+	static int step(const T *table, int state, char c) {
+		return table[state * 256 + static_cast<unsigned char>(c)];
+	}
+
+	//calls f with a pointer to whichever table is in use
+	template<class F>
+	auto with_table(F f) const {
+		switch(width_) {
+			case 1:  return f(table8_.data());
+			case 2:  return f(table16_.data());
+			default: return f(table32_.data());
+		}
+	}
+
+	//first position at or after p where state s doesn't loop to itself
+	const char *skip(int s, const char *p, const char *end) const {
+		const accel &a = accel_[s];
+		switch(a.k) {
+			case accel::kind::escape:
+				//a state that loops on every byte is never left
+				if(a.bytes.empty())
+					return end;
+				return find_any_of(p, end, a.bytes.data(), a.bytes.size());
+			case accel::kind::span:
+				return find_none_of(p, end, a.bytes.data(), a.bytes.size());
+			default:
+				return p;
+		}
+	}
+
+	template<class T>
+	const char *longest_at(const T *table,
+	                       const char *begin, const char *end) const
+	{
+		const char *last = accepting_[0] ? begin : nullptr;
+		int s = 0;
+		for(const char *p = begin; p != end; p++) {
+			if(accel_[s].k != accel::kind::none) {
+				const char *q = skip(s, p, end);
+				if(q != p && accepting_[s])
+					last = q;
+				if((p = q) == end)
+					break;
+			}
+			s = step(table, s, *p);
+			if(s == dead_)
+				break;
+			if(accepting_[s])
+				last = p + 1;
+		}
+		return last;
+	}
+
+	template<class T>
+	const char *longest_before(const T *table,
+	                           const char *begin, const char *end) const
+	{
+		const char *last = accepting_[0] ? end : nullptr;
+		int s = 0;
+		for(const char *p = end; p != begin; ) {
+			s = step(table, s, *--p);
+			if(s == dead_)
+				break;
+			if(accepting_[s])
+				last = p;
+		}
+		return last;
+	}
+
+	template<class T>
+	bool match(const T *table, const char *begin, const char *end) const {
+		int s = 0;
+		for(const char *p = begin; p != end && s != dead_; p++) {
+			if(accel_[s].k != accel::kind::none && (p = skip(s, p, end)) == end)
+				break;
+			s = step(table, s, *p);
+		}
+		return accepting_[s];
+	}
+
+public:
+	/* An empty table which never accepts anything */
+	dfa_table() : dfa_table(dfa()) {}
+
+	explicit dfa_table(const dfa &d)
+	: width_(d.size() < 0x100 ? 1 : d.size() < 0x10000 ? 2 : 4),
+	  accepting_(d.size() + 1), accel_(d.size() + 1), dead_(d.size())
+	{
+		std::vector<int> table((d.size() + 1) * 256, dead_);
+		auto live = d.live_states();
+		for(int s = 0; s < dead_; s++) {
+			accepting_[s] = d.accepting(s);
+			for(const auto &p : d.transitions[s]) {
+				if(live[p.second])
+					table[s * 256 + static_cast<unsigned char>(p.first)]
+						= p.second;
+			}
+		}
+		for(int s = 0; s < dead_; s++) {
+			std::string stay, leave;
+			for(int c = 0; c < 256; c++) {
+				if(table[s * 256 + c] == s)
+					stay += static_cast<char>(c);
+				else
+					leave += static_cast<char>(c);
+			}
+			if(stay.empty())
+				continue;
+			if(leave.size() <= 3)
+				accel_[s] = {accel::kind::escape, leave};
+			else if(stay.size() <= 3)
+				accel_[s] = {accel::kind::span, stay};
+		}
+		switch(width_) {
+			case 1:  table8_.assign(std::begin(table), std::end(table)); break;
+			case 2:  table16_.assign(std::begin(table), std::end(table)); break;
+			default: table32_.assign(std::begin(table), std::end(table)); break;
+		}
+	}
+
+	/* Bytes per state id in the transition table */
+	int state_width() const {
+		return width_;
+	}
+
+	/* Size of the transition table in bytes */
+	std::size_t table_bytes() const {
+		return std::size_t(dead_ + 1) * 256 * width_;
+	}
+
+	const accel &acceleration(int state) const {
+		return accel_[state];
+	}
+
+	bool accepting(int state) const {
+		return accepting_[state];
+	}
+
+	/* Returns true if the whole input is accepted */
+	bool match(const char *begin, const char *end) const {
+		return with_table([&](auto table) {
+			return match(table, begin, end);
+		});
+	}
+
+	/* End of the longest accepted prefix of [begin, end)
+	   or nullptr if no prefix is accepted */
+	const char *longest_at(const char *begin, const char *end) const {
+		return with_table([&](auto table) {
+			return longest_at(table, begin, end);
+		});
+	}
+
+	/* Runs backwards from `end`, returning the start of the longest accepted
+	   suffix of [begin, end) or nullptr. Meant for a reversed DFA */
+	const char *longest_before(const char *begin, const char *end) const {
+		return with_table([&](auto table) {
+			return longest_before(table, begin, end);
+		});
+	}
+};
+
+/* Matches and searches for one regex.
+ *
+ * Candidate start positions come from the prefilter, so bytes that can't
+ * start a match are skipped without touching a DFA at all. If every match
+ * contains an inner literal the search gives up once there are none left,
+ * and for patterns of bounded length it starts no further back than the
+ * longest match before the next one.
+ *
+ * When built with the reversed DFA as well, a search is two linear passes:
+ * a forward pass over the leftmost-longest search DFA finds where the match
+ * ends, then the reversed DFA is run backwards from there to find its start.
+ * Without it (or if the search DFA would be too big) every candidate position
+ * is tried in turn, which can be quadratic.
+ */
+class scanner {
+	dfa_table forward_;
+	bool two_pass_;
+	dfa_table search_;
+	dfa_table reverse_;
+	prefilter pf_;
+
+public:
+	struct span {
+		const char *begin;
+		const char *end;
+	};
+
+	/* Iterates over the non-overlapping leftmost-longest matches in a
+	   buffer. A default constructed iterator is the end */
+	class match_iterator {
+		const scanner *sc_;
+		const char *pos_, *end_;
+		span m_;
+	public:
+		typedef std::input_iterator_tag iterator_category;
+		typedef scanner::span value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef const scanner::span *pointer;
+		typedef const scanner::span &reference;
+
+		match_iterator() : sc_(nullptr), pos_(nullptr), end_(nullptr) {}
+		match_iterator(const scanner *sc, const char *begin, const char *end)
+		: sc_(sc), pos_(begin), end_(end)
+		{
+			++*this;
+		}
+
+		reference operator*() const { return m_; }
+		pointer operator->() const { return &m_; }
+
+		match_iterator &operator++() {
+			if(!sc_ || !pos_ || !sc_->find(pos_, end_, m_.begin, m_.end)) {
+				sc_ = nullptr;
+				return *this;
+			}
+			//an empty match can't be found again at the same place
+			if(m_.begin != m_.end)
+				pos_ = m_.end;
+			else if(m_.end != end_)
+				pos_ = m_.end + 1;
+			else
+				pos_ = nullptr;
+			return *this;
+		}
+		match_iterator operator++(int) {
+			auto res = *this;
+			++*this;
+			return res;
+		}
+
+		bool operator==(const match_iterator &o) const {
+			if(!sc_ || !o.sc_)
+				return sc_ == o.sc_;
+			return m_.begin == o.m_.begin && m_.end == o.m_.end;
+		}
+		bool operator!=(const match_iterator &o) const {
+			return !(*this == o);
+		}
+	};
+
+	struct match_range {
+		match_iterator first;
+		match_iterator begin() const { return first; }
+		match_iterator end() const { return match_iterator(); }
+	};
+
+	explicit scanner(const dfa &d)
+	: forward_(d), two_pass_(false), pf_(d)
+	{}
+
+	/* `reverse` should come from regex_tree::construct_reverse_dfa()
+	   The search DFA is built here and laid out by how often its states are
+	   visited over `sample`, or statically if there is none. The reversed
+	   one runs backwards, so it only gets the static layout */
+	scanner(const dfa &d, const dfa &reverse, const std::string &sample = "")
+	: forward_(d), two_pass_(true), reverse_(reverse.layout()), pf_(d)
+	{
+		try {
+			dfa search = d.leftmost_longest();
+			search_ = dfa_table(sample.empty() ? search.layout()
+			                                   : search.layout(sample));
+		} catch(std::runtime_error &) {
+			two_pass_ = false;
+		}
+	}
+
+	const dfa_table &table() const {
+		return forward_;
+	}
+
+	const prefilter &filter() const {
+		return pf_;
+	}
+
+	/* Returns true if the whole input is accepted */
+	bool match(const char *begin, const char *end) const {
+		return forward_.match(begin, end);
+	}
+	bool match(const std::string &str) const {
+		return match(str.data(), str.data() + str.size());
+	}
+
+	/* Finds the leftmost-longest match in [begin, end)
+	 * On success sets match_begin/match_end and returns true.
+	 */
+	bool find(const char *begin, const char *end,
+	          const char *&match_begin, const char *&match_end) const
+	{
+		if(!pf_.possible(begin, end))
+			return false;
+		//next inner literal, every match from p on has to contain one at or
+		//after p, so past the last one there is nothing left to find.
+		//The search DFA already stops at the first match, so there it's only
+		//worth an extra pass when it also bounds where the match starts
+		const char *lit = nullptr;
+		bool use_lit = !pf_.inner.empty()
+		            && (!two_pass_ || pf_.max_length != prefilter::unbounded);
+		auto seek = [&](const char *from) {
+			if(use_lit) {
+				if(!lit || lit < from)
+					lit = find_literal(from, end, pf_.inner);
+				if(lit == end)
+					return end;
+				from = pf_.start_bound(from, lit);
+			}
+			return pf_.next_candidate(from, end);
+		};
+		const char *p = seek(begin);
+		if(p == end && !forward_.accepting(0))
+			return false;
+		if(two_pass_) {
+			const char *e = search_.longest_at(p, end);
+			if(!e)
+				return false;
+			match_begin = reverse_.longest_before(p, e);
+			match_end = e;
+			return true;
+		}
+		while(true) {
+			if(const char *e = forward_.longest_at(p, end)) {
+				match_begin = p;
+				match_end = e;
+				return true;
+			}
+			p = seek(p + 1);
+			if(p == end && !forward_.accepting(0))
+				return false;
+		}
+	}
+	bool find(const std::string &str, std::size_t &pos, std::size_t &len) const
+	{
+		const char *b, *e;
+		if(!find(str.data(), str.data() + str.size(), b, e))
+			return false;
+		pos = b - str.data();
+		len = e - b;
+		return true;
+	}
+
+	/* All non-overlapping leftmost-longest matches in [begin, end) */
+	match_range matches(const char *begin, const char *end) const {
+		return {match_iterator(this, begin, end)};
+	}
+	match_range matches(const std::string &str) const {
+		return matches(str.data(), str.data() + str.size());
+	}
+};
+
+#endif //MBLIT_SCANNER_H
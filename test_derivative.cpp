@@ -0,0 +1,65 @@
+/* Checks the derivative backend against the followpos construction
+ *
+ * usage: test_derivative [PATTERN_FILE]
+ *
+ * For every pattern (one per line, default test_patterns.txt) both DFAs
+ * have to accept the same language, i.e. their difference is empty both
+ * ways, or both have to reject the pattern as invalid. Exits with 1 if any
+ * pattern disagrees.
+ */
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include "regex_tree.h"
+#include "derivative.h"
+
+//true if `d` accepts nothing at all
+bool accepts_nothing(const dfa &d) {
+	return d.size() == 0 || !d.live_states()[0];
+}
+
+bool same_language(const dfa &a, const dfa &b) {
+	return accepts_nothing(a.difference(b)) && accepts_nothing(b.difference(a));
+}
+
+int main(int argc, char **argv) {
+	std::string file = argc > 1 ? argv[1] : "test_patterns.txt";
+	std::ifstream in(file);
+	if(!in) {
+		std::cerr << "can't read " << file << "\n";
+		return 2;
+	}
+	//the check itself has to be able to fail
+	if(same_language(regex_tree("(a|b)*abb").construct_dfa(),
+	                 regex_tree("(a|b)*ab").construct_dfa())) {
+		std::cerr << "different languages compare equal\n";
+		return 1;
+	}
+
+	int patterns = 0, failures = 0;
+	std::string pattern;
+	while(std::getline(in, pattern)) {
+		patterns++;
+		//both parsers have to reject the same patterns
+		dfa followpos, derivative;
+		bool followpos_ok = true, derivative_ok = true;
+		try {
+			followpos = regex_tree(pattern).construct_dfa();
+		} catch(std::runtime_error &) {
+			followpos_ok = false;
+		}
+		try {
+			derivative = construct_derivative_dfa(pattern);
+		} catch(std::runtime_error &) {
+			derivative_ok = false;
+		}
+		if(followpos_ok != derivative_ok
+		   || (followpos_ok && !same_language(followpos, derivative))) {
+			std::cerr << "backends disagree on " << pattern << "\n";
+			failures++;
+		}
+	}
+	std::cout << patterns << " patterns, " << failures << " failed\n";
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,127 @@
+/* Checks rule_set's incremental minimization against building from scratch
+ *
+ * usage: test_rule_set [TRIALS] [SEED]
+ *
+ * Every trial adds and removes random rules over a small alphabet. After
+ * each update minimized() has to be isomorphic to the minimized() of a new
+ * rule_set holding the same rules, and has to have as many states as a full
+ * Moore partition of automaton(). Exits with 1 on the first difference.
+ */
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include "rule_set.h"
+
+std::mt19937 rng;
+
+std::string random_pattern(int depth) {
+	auto letter = [] { return std::string(1, "abc"[rng() % 3]); };
+	switch(rng() % (depth > 0 ? 5 : 2)) {
+		case 0:  return letter();
+		case 1:  return letter() + letter();
+		case 2:  return random_pattern(depth - 1) + random_pattern(depth - 1);
+		case 3:  return "(" + random_pattern(depth - 1) + "|"
+		                + random_pattern(depth - 1) + ")";
+		default: return "(" + random_pattern(depth - 1) + ")*";
+	}
+}
+
+/* True if a and b are the same DFA up to state numbering, with a's rule
+   ids turned into b's through `rule` */
+bool isomorphic(const dfa &a, const dfa &b, const std::map<int, int> &rule) {
+	if(a.size() != b.size())
+		return false;
+	std::vector<int> to_b(a.size(), -1);
+	std::vector<int> pending = {0};
+	to_b[0] = 0;
+	while(!pending.empty()) {
+		int s = pending.back();
+		pending.pop_back();
+		int t = to_b[s];
+		int token = a.accepting_[s] ? rule.at(a.accepting_[s] - 1) + 1 : 0;
+		if(token != b.accepting_[t]
+		   || a.transitions[s].size() != b.transitions[t].size())
+			return false;
+		for(const auto &p : a.transitions[s]) {
+			auto q = b.transitions[t].find(p.first);
+			if(q == std::end(b.transitions[t]))
+				return false;
+			if(to_b[p.second] == -1) {
+				to_b[p.second] = q->second;
+				pending.push_back(p.second);
+			} else if(to_b[p.second] != q->second) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/* Number of states of d after a Moore partition that tells tokens apart
+   Every state of a rule_set can reach an accepting one, so missing edges
+   are simply left out of the signatures */
+std::size_t minimal_size(const dfa &d) {
+	std::vector<int> block(std::begin(d.accepting_), std::end(d.accepting_));
+	std::size_t blocks = 0;
+	while(true) {
+		std::map<std::pair<int, std::vector<std::pair<char, int>>>, int> ids;
+		std::vector<int> next(d.size());
+		for(std::size_t s = 0; s < d.size(); s++) {
+			std::vector<std::pair<char, int>> edges;
+			for(const auto &p : d.transitions[s])
+				edges.emplace_back(p.first, block[p.second]);
+			auto key = std::make_pair(block[s], edges);
+			auto id = ids.emplace(key, int(ids.size())).first;
+			next[s] = id->second;
+		}
+		block = next;
+		if(ids.size() == blocks)
+			return blocks;
+		blocks = ids.size();
+	}
+}
+
+int main(int argc, char **argv) {
+	int trials = argc > 1 ? std::atoi(argv[1]) : 200;
+	rng.seed(argc > 2 ? std::atoi(argv[2]) : 1);
+	const int steps = 25;
+	for(int trial = 0; trial < trials; trial++) {
+		rule_set rules;
+		std::map<int, std::string> patterns;
+		for(int step = 0; step < steps; step++) {
+			std::string what;
+			if(patterns.empty() || rng() % 3) {
+				std::string pattern = random_pattern(3);
+				patterns[rules.add(pattern)] = pattern;
+				what = "add " + pattern;
+			} else {
+				auto victim = std::begin(patterns);
+				std::advance(victim, rng() % patterns.size());
+				what = "remove " + victim->second;
+				rules.remove(victim->first);
+				patterns.erase(victim);
+			}
+
+			rule_set fresh;
+			std::map<int, int> rule;
+			for(const auto &p : patterns)
+				rule[p.first] = fresh.add(p.second);
+			dfa m = rules.minimized();
+			const char *error = nullptr;
+			if(!isomorphic(m, fresh.minimized(), rule))
+				error = "differs from a fresh build";
+			else if(minimal_size(rules.automaton()) != m.size())
+				error = "isn't minimal";
+			if(error) {
+				std::cerr << "trial " << trial << " step " << step << " ("
+				          << what << "): minimized() " << error << "\n";
+				return 1;
+			}
+		}
+	}
+	std::cout << trials << " trials of " << steps << " updates, all ok\n";
+	return 0;
+}
@@ -0,0 +1,116 @@
+/* Checks scanner::matches() against a brute force leftmost-longest search
+ *
+ * usage: test_scanner [TRIALS] [SEED]
+ *
+ * Every trial builds a random pattern and runs both the one-DFA and the
+ * two-DFA scanner over random texts, long enough for the vectorized skips
+ * and the inner literal search to kick in. Their matches have to be exactly
+ * the non-overlapping leftmost-longest ones, including empty matches.
+ * Exits with 1 on the first difference.
+ */
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+#include "regex_tree.h"
+#include "scanner.h"
+
+typedef std::vector<std::pair<std::size_t, std::size_t>> spans;
+
+std::mt19937 rng;
+
+std::string random_pattern(int depth) {
+	auto letter = [] { return std::string(1, "abcde"[rng() % 5]); };
+	switch(rng() % (depth > 0 ? 7 : 2)) {
+		case 0:  return letter();
+		case 1:  return letter() + letter() + letter();
+		case 2:
+		case 3:  return random_pattern(depth - 1) + random_pattern(depth - 1);
+		case 4:  return "(" + random_pattern(depth - 1) + "|"
+		                + random_pattern(depth - 1) + ")";
+		//loops on nearly every byte, so the state is accelerated
+		case 5:  return "(a|b|c|d|e|f|g|h)*";
+		default: return "(" + random_pattern(depth - 1) + ")*";
+	}
+}
+
+std::string random_text() {
+	//mostly letters the patterns use, with a few that none of them do
+	const std::string letters = "abcdeabcdefghz\n";
+	std::string res(33 + rng() % 300, ' ');
+	for(char &c : res)
+		c = letters[rng() % letters.size()];
+	return res;
+}
+
+//end of the longest match of d starting at `begin`, or -1
+long longest_at(const dfa &d, const std::string &text, std::size_t begin) {
+	long res = d.accepting(0) ? long(begin) : -1;
+	int s = 0;
+	for(std::size_t i = begin; i < text.size(); i++) {
+		s = d.next(s, text[i]);
+		if(s == int(d.size()))
+			break;
+		if(d.accepting(s))
+			res = i + 1;
+	}
+	return res;
+}
+
+spans brute_force(const dfa &d, const std::string &text) {
+	spans res;
+	std::size_t pos = 0;
+	while(pos <= text.size()) {
+		long end = -1;
+		std::size_t begin = pos;
+		for(; begin <= text.size(); begin++) {
+			if((end = longest_at(d, text, begin)) != -1)
+				break;
+		}
+		if(end == -1)
+			break;
+		res.emplace_back(begin, end);
+		//same rule as match_iterator for empty matches
+		pos = std::size_t(end) != begin ? end : begin + 1;
+	}
+	return res;
+}
+
+spans found(const scanner &sc, const std::string &text) {
+	spans res;
+	for(const auto &m : sc.matches(text))
+		res.emplace_back(m.begin - text.data(), m.end - text.data());
+	return res;
+}
+
+int main(int argc, char **argv) {
+	int trials = argc > 1 ? std::atoi(argv[1]) : 1000;
+	rng.seed(argc > 2 ? std::atoi(argv[2]) : 1);
+	const int texts = 20;
+	for(int trial = 0; trial < trials; trial++) {
+		std::string pattern = random_pattern(3);
+		regex_tree tree(pattern);
+		dfa d = tree.construct_dfa().minimize();
+		dfa reverse = tree.construct_reverse_dfa().minimize();
+		scanner one(d.layout());
+		scanner two(d.layout(), reverse);
+		for(int i = 0; i < texts; i++) {
+			std::string text = random_text();
+			spans want = brute_force(d, text);
+			const char *which = nullptr;
+			if(found(one, text) != want)
+				which = "one-DFA";
+			else if(found(two, text) != want)
+				which = "two-DFA";
+			if(which) {
+				std::cerr << which << " scanner is wrong for " << pattern
+				          << " on \"" << text << "\"\n";
+				return 1;
+			}
+		}
+	}
+	std::cout << trials << " patterns on " << texts << " texts each, all ok\n";
+	return 0;
+}
@@ -0,0 +1,73 @@
+/* Checks dfa's set operations string by string
+ *
+ * usage: test_set_ops [TRIALS] [SEED]
+ *
+ * Every trial builds two random patterns over partly different alphabets
+ * and checks union_with, intersection, difference and complement on random
+ * strings against what the two DFAs accept on their own. Strings also use
+ * bytes neither pattern knows, which only the complement accepts.
+ * Exits with 1 on the first difference.
+ */
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include "regex_tree.h"
+
+std::mt19937 rng;
+
+std::string random_pattern(const std::string &letters, int depth) {
+	auto letter = [&] { return std::string(1, letters[rng() % letters.size()]); };
+	switch(rng() % (depth > 0 ? 5 : 2)) {
+		case 0:  return letter();
+		case 1:  return letter() + letter();
+		case 2:  return random_pattern(letters, depth - 1)
+		                + random_pattern(letters, depth - 1);
+		case 3:  return "(" + random_pattern(letters, depth - 1) + "|"
+		                + random_pattern(letters, depth - 1) + ")";
+		default: return "(" + random_pattern(letters, depth - 1) + ")*";
+	}
+}
+
+bool accepts(const dfa &d, const std::string &s) {
+	int state = 0;
+	for(char c : s)
+		state = d.next(state, c);
+	return d.accepting(state);
+}
+
+int main(int argc, char **argv) {
+	int trials = argc > 1 ? std::atoi(argv[1]) : 300;
+	rng.seed(argc > 2 ? std::atoi(argv[2]) : 1);
+	const int strings = 300;
+	const std::string letters = "abcz\xff";
+	for(int trial = 0; trial < trials; trial++) {
+		std::string pa = random_pattern("abc", 3), pb = random_pattern("bc", 3);
+		dfa a = regex_tree(pa).construct_dfa(), b = regex_tree(pb).construct_dfa();
+		dfa either = a.union_with(b), both = a.intersection(b);
+		dfa only_a = a.difference(b), not_a = a.complement();
+		for(int i = 0; i < strings; i++) {
+			std::string s(rng() % 10, ' ');
+			for(char &c : s)
+				c = letters[rng() % letters.size()];
+			bool in_a = accepts(a, s), in_b = accepts(b, s);
+			const char *op = nullptr;
+			if(accepts(either, s) != (in_a || in_b))
+				op = "union_with";
+			else if(accepts(both, s) != (in_a && in_b))
+				op = "intersection";
+			else if(accepts(only_a, s) != (in_a && !in_b))
+				op = "difference";
+			else if(accepts(not_a, s) == in_a)
+				op = "complement";
+			if(op) {
+				std::cerr << op << " is wrong for " << pa << " and " << pb
+				          << " on \"" << s << "\"\n";
+				return 1;
+			}
+		}
+	}
+	std::cout << trials << " pattern pairs on " << strings
+	          << " strings each, all ok\n";
+	return 0;
+}